@@ -0,0 +1,424 @@
+#include "batch.h"
+#include "job.h"
+#include "pool.h"
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <dirent.h>
+#include <sys/stat.h>
+
+MpegBatch::MpegBatch(const Options *options, const char *prog) : _options(options), _prog(prog)
+{
+}
+
+MpegBatch::~MpegBatch()
+{
+    for (unsigned i = 0; i < _cnt; i++)
+    {
+        free(_job[i].line);
+        free(_job[i].argv);
+    }
+
+    free(_job);
+}
+
+int MpegBatch::mpeg_batch_add(char *line)
+{
+    int argc;
+    char **argv;
+
+    if (Options::tokenize(line, _prog, &argc, &argv))
+    {
+        free(line);
+        return 1;
+    }
+
+    if (argc < 2)
+    {
+        free(argv);
+        free(line);
+        return 0;
+    }
+
+    if (_cnt >= _max)
+    {
+        unsigned max = _max > 0 ? 2 * _max : 64;
+        mpeg_batch_job_t *job = (mpeg_batch_job_t *)realloc(_job, max * sizeof(mpeg_batch_job_t));
+
+        if (job == NULL)
+        {
+            free(argv);
+            free(line);
+            return 1;
+        }
+
+        _job = job;
+        _max = max;
+    }
+
+    mpeg_batch_job_t *job = &_job[_cnt++];
+    memset(job, 0, sizeof(*job));
+    job->line = line;
+    job->argc = argc;
+    job->argv = argv;
+    job->ret = 1;
+    return 0;
+}
+
+int MpegBatch::mpeg_batch_manifest(const char *name)
+{
+    FILE *fp = strcmp(name, "-") == 0 ? stdin : fopen(name, "r");
+
+    if (fp == NULL)
+    {
+        fprintf(stderr, "batch: can't open manifest (%s)\n", name);
+        return 1;
+    }
+
+    char *buf = NULL;
+    size_t max = 0;
+    int r = 0;
+
+    while (r == 0 && getline(&buf, &max, fp) >= 0)
+    {
+        char *line = strdup(buf);
+
+        if (line == NULL || mpeg_batch_add(line))
+            r = 1;
+    }
+
+    free(buf);
+
+    if (fp != stdin)
+        fclose(fp);
+
+    return r;
+}
+
+static int mpeg_batch_cmp(const void *p1, const void *p2)
+{
+    return strcmp(*(char *const *)p1, *(char *const *)p2);
+}
+
+int MpegBatch::mpeg_batch_dir(const char *name)
+{
+    DIR *dir = opendir(name);
+
+    if (dir == NULL)
+    {
+        fprintf(stderr, "batch: can't open directory (%s)\n", name);
+        return 1;
+    }
+
+    char **list = NULL;
+    unsigned cnt = 0;
+    unsigned max = 0;
+    struct dirent *ent;
+    int r = 0;
+
+    while (r == 0 && (ent = readdir(dir)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+            continue;
+
+        size_t n = strlen(name) + strlen(ent->d_name) + 2;
+        char *path = (char *)malloc(n);
+        struct stat st;
+
+        if (path == NULL)
+        {
+            r = 1;
+            break;
+        }
+
+        snprintf(path, n, "%s/%s", name, ent->d_name);
+
+        if (stat(path, &st) || !S_ISREG(st.st_mode))
+        {
+            free(path);
+            continue;
+        }
+
+        if (cnt >= max)
+        {
+            max = max > 0 ? 2 * max : 64;
+            char **tmp = (char **)realloc(list, max * sizeof(char *));
+
+            if (tmp == NULL)
+            {
+                free(path);
+                r = 1;
+                break;
+            }
+
+            list = tmp;
+        }
+
+        list[cnt++] = path;
+    }
+
+    closedir(dir);
+
+    // one job per file, in name order
+    if (cnt > 0)
+        qsort(list, cnt, sizeof(char *), mpeg_batch_cmp);
+
+    for (unsigned i = 0; i < cnt; i++)
+    {
+        char *line = (char *)malloc(strlen(list[i]) + 3);
+
+        if (r == 0 && line != NULL)
+        {
+            sprintf(line, "\"%s\"", list[i]);
+            r = mpeg_batch_add(line);
+        }
+        else
+        {
+            free(line);
+            r = 1;
+        }
+
+        free(list[i]);
+    }
+
+    free(list);
+    return r;
+}
+
+char *MpegBatch::mpeg_batch_name(const char *tmpl, const char *inp, unsigned idx)
+{
+    const char *file = strrchr(inp, '/');
+    file = file != NULL ? file + 1 : inp;
+    const char *ext = strrchr(file, '.');
+    size_t nlen = ext != NULL && ext != file ? size_t(ext - file) : strlen(file);
+    size_t dlen = file > inp ? size_t(file - inp - 1) : 0;
+    char num[16];
+    snprintf(num, sizeof(num), "%u", idx);
+
+    size_t n = 1;
+
+    for (const char *s = tmpl; *s != 0; s++)
+        n += s[0] == '%' ? strlen(inp) + sizeof(num) : 1;
+
+    char *ret = (char *)malloc(n);
+
+    if (ret == NULL)
+        return NULL;
+
+    char *d = ret;
+
+    for (const char *s = tmpl; *s != 0; s++)
+    {
+        if (s[0] != '%' || s[1] == 0)
+        {
+            *d++ = *s;
+            continue;
+        }
+
+        s += 1;
+
+        switch (*s)
+        {
+        case 'n':
+            memcpy(d, file, nlen);
+            d += nlen;
+            break;
+        case 'f':
+            strcpy(d, file);
+            d += strlen(file);
+            break;
+        case 'd':
+            if (dlen > 0)
+            {
+                memcpy(d, inp, dlen);
+                d += dlen;
+            }
+            else
+            {
+                *d++ = file > inp ? '/' : '.';
+            }
+            break;
+        case 'i':
+            strcpy(d, num);
+            d += strlen(num);
+            break;
+        default:
+            *d++ = *s;
+            break;
+        }
+    }
+
+    *d = 0;
+    return ret;
+}
+
+// replace a template in place with its expansion for this job
+static int mpeg_batch_expand(char **name, char *val)
+{
+    if (val == NULL)
+        return 1;
+
+    free(*name);
+    *name = val;
+    return 0;
+}
+
+int MpegBatch::mpeg_batch_job(unsigned i)
+{
+    mpeg_batch_job_t *job = &_job[i];
+    Options opts(*_options);
+
+    if (opts.parse(job->argc, job->argv))
+        return 1;
+
+    if (opts._batch_name != NULL || opts._arg_inp == NULL)
+    {
+        fprintf(stderr, "batch: bad job (%s)\n", job->argv[1]);
+        return 1;
+    }
+
+    job->inp = opts._arg_inp;
+    char *out = NULL;
+
+    if (opts._arg_out == NULL && _options->_arg_inp != NULL)
+    {
+        out = mpeg_batch_name(_options->_arg_inp, job->inp, i);
+
+        if (out == NULL)
+            return 1;
+
+        opts._arg_out = out;
+    }
+
+    if (opts._demux_name != NULL && strchr(opts._demux_name, '%') != NULL)
+        if (mpeg_batch_expand(&opts._demux_name, mpeg_batch_name(opts._demux_name, job->inp, i)))
+            return 1;
+
+    if (opts._journal_name != NULL && strchr(opts._journal_name, '%') != NULL)
+        if (mpeg_batch_expand(&opts._journal_name, mpeg_batch_name(opts._journal_name, job->inp, i)))
+            return 1;
+
+    if (opts.open(_prog))
+    {
+        if (opts._par_inp != NULL && opts._par_inp != stdin)
+            fclose(opts._par_inp);
+
+        free(out);
+        return 1;
+    }
+
+    // standard output is collected and printed in job order
+    if (opts._par_out == stdout)
+    {
+        job->log = tmpfile();
+
+        if (job->log == NULL)
+            return 1;
+
+        opts._par_out = job->log;
+    }
+
+    struct stat st;
+
+    if (fstat(fileno(opts._par_inp), &st) == 0 && S_ISREG(st.st_mode))
+        job->size = uint64_t(st.st_size);
+
+    auto t0 = std::chrono::steady_clock::now();
+    int r = mpeg_job_run(&opts);
+    auto t1 = std::chrono::steady_clock::now();
+    job->time = std::chrono::duration<double>(t1 - t0).count();
+
+    if (opts._par_inp != stdin)
+        fclose(opts._par_inp);
+
+    if (opts._par_out != job->log && fclose(opts._par_out))
+        r = 1;
+
+    free(out);
+    return r;
+}
+
+void MpegBatch::mpeg_batch_worker(void *ctx, unsigned i)
+{
+    MpegBatch *batch = (MpegBatch *)ctx;
+    batch->_job[i].ret = batch->mpeg_batch_job(i);
+}
+
+int MpegBatch::run()
+{
+    const char *name = _options->_batch_name;
+    struct stat st;
+    int r;
+
+    if (_options->_arg_out != NULL)
+    {
+        fprintf(stderr, "batch: too many files (%s)\n", _options->_arg_out);
+        return 1;
+    }
+
+    if (strcmp(name, "-") != 0 && stat(name, &st) == 0 && S_ISDIR(st.st_mode))
+        r = mpeg_batch_dir(name);
+    else
+        r = mpeg_batch_manifest(name);
+
+    if (r)
+        return 1;
+
+    auto t0 = std::chrono::steady_clock::now();
+    mpeg_pool_t pool;
+    unsigned threads = _options->jobs() > 0 ? _options->jobs() : mpeg_pool_t::cores();
+    pool.run(_cnt, threads, mpeg_batch_worker, this);
+    auto t1 = std::chrono::steady_clock::now();
+
+    unsigned failed = 0;
+    uint64_t size = 0;
+    double time = 0.0;
+
+    for (unsigned i = 0; i < _cnt; i++)
+    {
+        mpeg_batch_job_t *job = &_job[i];
+
+        if (job->log != NULL)
+        {
+            char buf[4096];
+            size_t n;
+            rewind(job->log);
+
+            while ((n = fread(buf, 1, sizeof(buf), job->log)) > 0)
+                if (fwrite(buf, 1, n, stdout) != n)
+                    r = 1;
+
+            fclose(job->log);
+            job->log = NULL;
+        }
+
+        if (job->ret)
+        {
+            fprintf(stderr, "batch: job %u failed (%s)\n", i,
+                job->inp != NULL ? job->inp : job->argv[1]);
+
+            failed += 1;
+        }
+
+        size += job->size;
+        time += job->time;
+    }
+
+    double wall = std::chrono::duration<double>(t1 - t0).count();
+
+    fprintf(stderr, "Jobs:           %u ok / %u failed\n", _cnt - failed, failed);
+    fprintf(stderr, "Input:          %" PRIuMAX " bytes\n", uintmax_t(size));
+    fprintf(stderr, "Time:           %.3f s / %.3f s busy\n", wall, time);
+
+    if (wall > 0.0)
+        fprintf(stderr, "Rate:           %.2f MB/s\n", double(size) / wall / 1e6);
+
+    fflush(stdout);
+
+    if (r || failed > 0)
+        return 1;
+
+    return 0;
+}
+
+
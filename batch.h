@@ -0,0 +1,49 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <inttypes.h>
+#include <cstdio>
+#include "options.h"
+
+struct mpeg_batch_job_t
+{
+    char *line;
+    int argc;
+    char **argv;
+    const char *inp;
+    FILE *log;
+    uint64_t size;
+    double time;
+    int ret;
+};
+
+/*
+ * Batch front end. Every manifest line is a command line of its own,
+ * "[options] input [output]", applied on top of the global options.
+ * A directory gives one job per regular file. In output, base name and
+ * journal names %n is the input name without extension, %f the input
+ * file name, %d its directory and %i the job number.
+ */
+class MpegBatch
+{
+private:
+    const Options *_options;
+    const char *_prog;
+    mpeg_batch_job_t *_job = nullptr;
+    unsigned _cnt = 0;
+    unsigned _max = 0;
+    int mpeg_batch_add(char *line);
+    int mpeg_batch_manifest(const char *name);
+    int mpeg_batch_dir(const char *name);
+    char *mpeg_batch_name(const char *tmpl, const char *inp, unsigned idx);
+    int mpeg_batch_job(unsigned i);
+    static void mpeg_batch_worker(void *ctx, unsigned i);
+public:
+    MpegBatch(const Options *options, const char *prog);
+    ~MpegBatch();
+    int run();
+};
+
+#endif
+
+
@@ -1,5 +1,6 @@
 #include "buffer.h"
 #include <cstdlib>
+#include <cstring>
 
 void mpeg_buffer_t::init()
 {
@@ -61,6 +62,26 @@ int mpeg_buffer_t::setCnt(unsigned cnt)
     return 0;
 }
 
+int mpeg_buffer_t::append(const void *buf, unsigned n)
+{
+    unsigned i = cnt;
+
+    if (i + n > max)
+    {
+        unsigned m = max < 4096 ? 4096 : max;
+
+        while (m < i + n)
+            m *= 2;
+
+        if (setMax(m))
+            return 1;
+    }
+
+    memcpy(this->buf + i, buf, n);
+    cnt = i + n;
+    return 0;
+}
+
 int mpeg_buffer_t::write_clear(FILE *fp)
 {
     if (cnt > 0)
@@ -15,6 +15,7 @@ public:
     void init();
     void free();
     void clear();
+    int append(const void *buf, unsigned n);
     int write_clear(FILE *fp);
 };
 
@@ -0,0 +1,226 @@
+#include "clone.h"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+int mpeg_clone_t::active() const
+{
+    return _active;
+}
+
+int mpeg_clone_t::open(FILE *inp, FILE *out)
+{
+    _active = 0;
+
+    if (inp == NULL || out == NULL || fflush(out))
+        return 1;
+
+    _src = fileno(inp);
+    _dst = fileno(out);
+
+    if (_src < 0 || _dst < 0)
+        return 1;
+
+    struct stat st;
+
+    if (fstat(_src, &st) || !S_ISREG(st.st_mode))
+        return 1;
+
+    if (fstat(_dst, &st) || !S_ISREG(st.st_mode))
+        return 1;
+
+    off_t ofs = ftello(out);
+
+    if (ofs < 0)
+        return 1;
+
+    _out = out;
+    _blk = st.st_blksize > 0 ? uint32_t(st.st_blksize) : 4096;
+    _dst_ofs = uint64_t(ofs);
+    _src_ofs = 0;
+    _cnt = 0;
+    _patch_cnt = 0;
+    _active = 1;
+    return 0;
+}
+
+int mpeg_clone_t::_pwrite(const void *buf, uint64_t n, uint64_t dst)
+{
+    const uint8_t *tmp = (const uint8_t *)buf;
+
+    while (n > 0)
+    {
+        ssize_t r = pwrite(_dst, tmp, n, off_t(dst));
+
+        if (r <= 0)
+            return 1;
+
+        tmp += r;
+        dst += uint64_t(r);
+        n -= uint64_t(r);
+    }
+
+    return 0;
+}
+
+int mpeg_clone_t::_copy_data(uint64_t src, uint64_t dst, uint64_t n)
+{
+    while (n > 0 && _offload)
+    {
+        off64_t s = off64_t(src);
+        off64_t d = off64_t(dst);
+        ssize_t r = copy_file_range(_src, &s, _dst, &d, n, 0);
+
+        if (r < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+            || errno == EOPNOTSUPP))
+        {
+            _offload = 0;
+            break;
+        }
+
+        if (r <= 0)
+            return 1;
+
+        src += uint64_t(r);
+        dst += uint64_t(r);
+        n -= uint64_t(r);
+    }
+
+    uint8_t buf[65536];
+
+    while (n > 0)
+    {
+        size_t i = n < sizeof(buf) ? size_t(n) : sizeof(buf);
+        ssize_t r = pread(_src, buf, i, off_t(src));
+
+        if (r <= 0)
+            return 1;
+
+        if (_pwrite(buf, uint64_t(r), dst))
+            return 1;
+
+        src += uint64_t(r);
+        dst += uint64_t(r);
+        n -= uint64_t(r);
+    }
+
+    return 0;
+}
+
+int mpeg_clone_t::_copy(uint64_t src, uint64_t dst, uint64_t n)
+{
+    // extents can only be shared if both sides have the same alignment
+    if (_reflink && (src % _blk) == (dst % _blk))
+    {
+        uint64_t head = (_blk - src % _blk) % _blk;
+
+        if (head < n && n - head >= _blk)
+        {
+            uint64_t len = (n - head) / _blk * _blk;
+            struct file_clone_range r;
+            r.src_fd = _src;
+            r.src_offset = src + head;
+            r.src_length = len;
+            r.dest_offset = dst + head;
+
+            if (ioctl(_dst, FICLONERANGE, &r) == 0)
+            {
+                if (_copy_data(src, dst, head))
+                    return 1;
+
+                head += len;
+                return _copy_data(src + head, dst + head, n - head);
+            }
+
+            _reflink = 0;
+        }
+    }
+
+    return _copy_data(src, dst, n);
+}
+
+int mpeg_clone_t::copy(uint64_t ofs, uint64_t n)
+{
+    if (_cnt > 0 && ofs == _src_ofs + _cnt)
+    {
+        _cnt += n;
+        return 0;
+    }
+
+    if (flush())
+        return 1;
+
+    _src_ofs = ofs;
+    _cnt = n;
+    return 0;
+}
+
+int mpeg_clone_t::patch(uint64_t ofs, uint8_t val)
+{
+    if (ofs >= _src_ofs + _cnt)
+        return 1;
+
+    // the last range maps linearly, even if it was already flushed
+    _patch_ofs[_patch_cnt] = _dst_ofs + ofs - _src_ofs;
+    _patch_val[_patch_cnt] = val;
+    _patch_cnt += 1;
+
+    if (_patch_cnt >= MPEG_CLONE_PATCHES)
+        return flush();
+
+    return 0;
+}
+
+int mpeg_clone_t::write(const void *buf, unsigned n)
+{
+    if (flush())
+        return 1;
+
+    if (_pwrite(buf, n, _dst_ofs))
+        return 1;
+
+    _dst_ofs += n;
+    return 0;
+}
+
+int mpeg_clone_t::flush()
+{
+    int r = 0;
+
+    if (_cnt > 0)
+    {
+        if (_copy(_src_ofs, _dst_ofs, _cnt))
+            r = 1;
+
+        // patch after copying, so that shared extents are unshared
+        // only where a byte actually changes
+        for (unsigned i = 0; i < _patch_cnt; i++)
+            if (_pwrite(&_patch_val[i], 1, _patch_ofs[i]))
+                r = 1;
+
+        _src_ofs += _cnt;
+        _dst_ofs += _cnt;
+        _cnt = 0;
+    }
+
+    _patch_cnt = 0;
+    return r;
+}
+
+int mpeg_clone_t::close()
+{
+    if (_active == 0)
+        return 0;
+
+    int r = flush();
+    _active = 0;
+
+    if (fseeko(_out, off_t(_dst_ofs), SEEK_SET))
+        r = 1;
+
+    return r;
+}
+
+
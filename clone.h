@@ -0,0 +1,46 @@
+#ifndef CLONE_H
+#define CLONE_H
+
+#include <inttypes.h>
+#include <cstdio>
+
+static constexpr unsigned MPEG_CLONE_PATCHES = 256;
+
+/*
+ * Copies input ranges into the output without passing them through
+ * user space. Aligned blocks are shared with FICLONERANGE where the
+ * file system supports it, everything else goes through
+ * copy_file_range. Patched bytes are written over the copied range.
+ */
+class mpeg_clone_t
+{
+private:
+    FILE *_out = nullptr;
+    int _src = -1;
+    int _dst = -1;
+    int _active = 0;
+    int _reflink = 1;
+    int _offload = 1;
+    uint32_t _blk = 4096;
+    uint64_t _src_ofs = 0;
+    uint64_t _dst_ofs = 0;
+    uint64_t _cnt = 0;
+    unsigned _patch_cnt = 0;
+    uint64_t _patch_ofs[MPEG_CLONE_PATCHES];
+    uint8_t _patch_val[MPEG_CLONE_PATCHES];
+    int _pwrite(const void *buf, uint64_t n, uint64_t dst);
+    int _copy_data(uint64_t src, uint64_t dst, uint64_t n);
+    int _copy(uint64_t src, uint64_t dst, uint64_t n);
+public:
+    int active() const;
+    int open(FILE *inp, FILE *out);
+    int copy(uint64_t ofs, uint64_t n);
+    int patch(uint64_t ofs, uint8_t val);
+    int write(const void *buf, unsigned n);
+    int flush();
+    int close();
+};
+
+#endif
+
+
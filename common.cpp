@@ -1,8 +1,12 @@
 #include "common.h"
 #include "buffer.h"
 #include "options.h"
+#include "direct.h"
+#include "frame.h"
+#include "sync.h"
 #include <cstring>
 #include <cstdlib>
+#include <sys/stat.h>
 
 //virtual method
 int mpeg_demux_t::pack()
@@ -34,40 +38,460 @@ int mpeg_demux_t::end()
     return 0;
 }
 
-mpeg_demux_t::mpeg_demux_t(FILE *fp, Options *options) : _options(options), _fp(fp)
+//virtual method
+unsigned mpeg_demux_t::index_units()
+{
+    return 0;
+}
+
+//virtual method
+int mpeg_demux_t::start(FILE *out)
+{
+    _ext = out;
+    return 0;
+}
+
+//virtual method
+int mpeg_demux_t::finish(int r)
+{
+    close();
+    return r;
+}
+
+mpeg_demux_t::mpeg_demux_t(FILE *fp, const Options *options) : _options(options), _fp(fp)
 {
     _ext = NULL;
+    memset(_deselect, 0, sizeof(_deselect));
+
+    for (unsigned i = 0; i < 512; i++)
+        _fp2[i] = NULL;
+
+    memset(_sum, 0, sizeof(_sum));
+    memset(&_sum_out, 0, sizeof(_sum_out));
     _resetStats();
+    struct stat st;
+
+    if (fp != NULL && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        _seekable = ftello(fp) >= 0;
+        _size = uint64_t(st.st_size);
+    }
 }
 
-MpegDemux::MpegDemux(FILE *fp, Options *options) : mpeg_demux_t(fp, options)
+// copy a partial output to the end of fp
+static int mpeg_append(FILE *fp, FILE *src)
 {
+    uint8_t buf[4096];
+    size_t n;
+
+    if (fseeko(src, 0, SEEK_SET))
+        return 1;
+
+    while ((n = fread(buf, 1, sizeof(buf), src)) > 0)
+        if (fwrite(buf, 1, n, fp) != n)
+            return 1;
+
+    return ferror(src) ? 1 : 0;
 }
 
-MpegList::MpegList(FILE *fp, Options *options) : mpeg_demux_t(fp, options)
+static int mpeg_put(FILE *fp, uint64_t val, unsigned n)
 {
+    uint8_t buf[8];
+
+    for (unsigned i = 0; i < n; i++)
+        buf[i] = uint8_t(val >> (8 * i));
+
+    return fwrite(buf, 1, n, fp) != n;
 }
 
-MpegRemux::MpegRemux(FILE *fp, Options *options) : mpeg_demux_t(fp, options)
+static int mpeg_get(FILE *fp, uint64_t *val, unsigned n)
 {
+    uint8_t buf[8];
+
+    if (fread(buf, 1, n, fp) != n)
+        return 1;
+
+    *val = 0;
+
+    for (unsigned i = 0; i < n; i++)
+        *val |= uint64_t(buf[i]) << (8 * i);
+
+    return 0;
 }
 
-MpegScan::MpegScan(FILE *inp, Options *options) : mpeg_demux_t(inp, options)
+// a partial output with its length in front
+static int mpeg_put_file(FILE *fp, FILE *src)
 {
+    if (fflush(src) || fseeko(src, 0, SEEK_END))
+        return 1;
+
+    off_t n = ftello(src);
+
+    if (n < 0 || mpeg_put(fp, uint64_t(n), 8))
+        return 1;
+
+    return mpeg_append(fp, src);
 }
 
-int MpegDemux::demux(FILE *inp, FILE *out)
+static FILE *mpeg_get_file(FILE *fp)
+{
+    uint64_t n;
+    uint8_t buf[4096];
+
+    if (mpeg_get(fp, &n, 8))
+        return NULL;
+
+    FILE *ret = tmpfile();
+
+    while (ret != NULL && n > 0)
+    {
+        size_t i = n < sizeof(buf) ? size_t(n) : sizeof(buf);
+
+        if (fread(buf, 1, i, fp) != i || fwrite(buf, 1, i, ret) != i)
+        {
+            fclose(ret);
+            return NULL;
+        }
+
+        n -= i;
+    }
+
+    return ret;
+}
+
+/*
+ * Write the state a merge needs from a partial parse: counters, stream
+ * stats and sums, the main output and the stream files. Numbers are
+ * little endian so parts can come from other machines.
+ */
+int mpeg_demux_t::save(FILE *fp)
+{
+    int r = mpeg_put(fp, _shdr_cnt, 4) || mpeg_put(fp, _pack_cnt, 4)
+        || mpeg_put(fp, _packet_cnt, 4) || mpeg_put(fp, _end_cnt, 4)
+        || mpeg_put(fp, _skip_cnt, 4);
+
+    for (unsigned i = 0; i < 256 && r == 0; i++)
+    {
+        r = mpeg_put(fp, streams[i].packet_cnt, 4) || mpeg_put(fp, streams[i].size, 8)
+            || mpeg_put(fp, substreams[i].packet_cnt, 4) || mpeg_put(fp, substreams[i].size, 8);
+    }
+
+    for (unsigned i = 0; i < 512 && r == 0; i++)
+        r = mpeg_put(fp, _sum[i].crc, 4) || mpeg_put(fp, _sum[i].len, 8);
+
+    if (r || mpeg_put_file(fp, _ext))
+        return 1;
+
+    for (unsigned i = 0; i < 512; i++)
+    {
+        if (_fp2[i] == NULL || _fp2[i] == _ext)
+            continue;
+
+        if (mpeg_put(fp, i, 2) || mpeg_put_file(fp, _fp2[i]))
+            return 1;
+    }
+
+    return mpeg_put(fp, 0xffff, 2);
+}
+
+// read back what save() wrote, the outputs become temporary files
+int mpeg_demux_t::load(FILE *fp)
+{
+    uint64_t v[4];
+
+    if (mpeg_get(fp, &v[0], 4) || mpeg_get(fp, &v[1], 4) || mpeg_get(fp, &v[2], 4)
+        || mpeg_get(fp, &v[3], 4))
+        return 1;
+
+    _shdr_cnt = uint32_t(v[0]);
+    _pack_cnt = uint32_t(v[1]);
+    _packet_cnt = uint32_t(v[2]);
+    _end_cnt = uint32_t(v[3]);
+
+    if (mpeg_get(fp, &v[0], 4))
+        return 1;
+
+    _skip_cnt = uint32_t(v[0]);
+
+    for (unsigned i = 0; i < 256; i++)
+    {
+        if (mpeg_get(fp, &v[0], 4) || mpeg_get(fp, &v[1], 8)
+            || mpeg_get(fp, &v[2], 4) || mpeg_get(fp, &v[3], 8))
+            return 1;
+
+        streams[i].packet_cnt = uint32_t(v[0]);
+        streams[i].size = v[1];
+        substreams[i].packet_cnt = uint32_t(v[2]);
+        substreams[i].size = v[3];
+    }
+
+    for (unsigned i = 0; i < 512; i++)
+    {
+        if (mpeg_get(fp, &v[0], 4) || mpeg_get(fp, &v[1], 8))
+            return 1;
+
+        _sum[i].crc = uint32_t(v[0]);
+        _sum[i].len = v[1];
+    }
+
+    _partial = 1;
+    _ext = mpeg_get_file(fp);
+
+    if (_ext == NULL)
+        return 1;
+
+    while (true)
+    {
+        if (mpeg_get(fp, &v[0], 2))
+            return 1;
+
+        if (v[0] == 0xffff)
+            return 0;
+
+        if (v[0] >= 512 || _fp2[v[0]] != NULL)
+            return 1;
+
+        _fp2[v[0]] = mpeg_get_file(fp);
+
+        if (_fp2[v[0]] == NULL)
+            return 1;
+    }
+}
+
+// close the partial outputs that are left after a save or merge
+void mpeg_demux_t::unload()
 {
     for (unsigned i = 0; i < 512; i++)
+    {
+        if (_fp2[i] != NULL && _fp2[i] != _ext)
+            fclose(_fp2[i]);
+
         _fp2[i] = NULL;
+    }
 
-    _ext = out;
-    int r = parse(this);
+    if (_ext != NULL)
+        fclose(_ext);
+
+    _ext = NULL;
+}
+
+mpeg_demux_t::~mpeg_demux_t()
+{
+    _packet_buf.free();
+    _shdr_buf.free();
+    _pack_buf.free();
+}
+
+// checksum everything written to fp, partial outputs are summed by the merge
+FILE *mpeg_demux_t::mpeg_sum_open(FILE *fp, mpeg_sum_t *sum, int close_fp)
+{
+    if (_options->checksum() == 0 || _partial)
+        return fp;
+
+    FILE *ret = mpeg_crc_t::open(fp, sum, close_fp);
+
+    if (ret == NULL)
+    {
+        fprintf(stderr, "can't checksum output\n");
+
+        if (close_fp)
+            fclose(fp);
+
+        return NULL;
+    }
+
+    _summed = 1;
+    return ret;
+}
+
+// only parse the packs that start in [start, end)
+void mpeg_demux_t::range(uint64_t start, uint64_t end, int partial)
+{
+    _range_start = start;
+    _range_end = end;
+    _partial = partial;
+}
+
+// take over the parser state of mpeg, the handlers read the unit at ofs from buf
+void mpeg_demux_t::feed(const mpeg_demux_t *mpeg, uint64_t ofs, const uint8_t *buf, unsigned n)
+{
+    _ofs = ofs;
+    _buf_i = 0;
+    _buf_n = 0;
+    _src = buf;
+    _src_n = n;
+    _shdr = mpeg->_shdr;
+    _packet = mpeg->_packet;
+    _pack = mpeg->_pack;
+    _shdr_cnt = mpeg->_shdr_cnt;
+    _pack_cnt = mpeg->_pack_cnt;
+    _packet_cnt = mpeg->_packet_cnt;
+    _end_cnt = mpeg->_end_cnt;
+    _skip_cnt = mpeg->_skip_cnt;
+    streams[_packet.sid] = mpeg->streams[_packet.sid];
+    substreams[_packet.ssid] = mpeg->substreams[_packet.ssid];
+}
+
+void mpeg_demux_t::feed_stats(const mpeg_demux_t *mpeg)
+{
+    feed(mpeg, mpeg->_ofs, NULL, 0);
+    memcpy(streams, mpeg->streams, sizeof(streams));
+    memcpy(substreams, mpeg->substreams, sizeof(substreams));
+}
+
+void mpeg_demux_t::mpeg_add_stats(const mpeg_demux_t *mpeg)
+{
+    _shdr_cnt += mpeg->_shdr_cnt;
+    _pack_cnt += mpeg->_pack_cnt;
+    _packet_cnt += mpeg->_packet_cnt;
+    _end_cnt += mpeg->_end_cnt;
+    _skip_cnt += mpeg->_skip_cnt;
+
+    for (unsigned i = 0; i < 256; i++)
+    {
+        streams[i].packet_cnt += mpeg->streams[i].packet_cnt;
+        streams[i].size += mpeg->streams[i].size;
+        substreams[i].packet_cnt += mpeg->substreams[i].packet_cnt;
+        substreams[i].size += mpeg->substreams[i].size;
+    }
+}
+
+MpegDemux::MpegDemux(FILE *fp, const Options *options) : mpeg_demux_t(fp, options)
+{
+}
+
+MpegList::MpegList(FILE *fp, const Options *options) : mpeg_demux_t(fp, options)
+{
+}
+
+MpegRemux::MpegRemux(FILE *fp, const Options *options) : mpeg_demux_t(fp, options)
+{
+}
+
+MpegScan::MpegScan(FILE *inp, const Options *options) : mpeg_demux_t(inp, options)
+{
+}
+
+// only the selected packets are read
+unsigned MpegDemux::index_units()
+{
+    return 1 << MPEG_INDEX_PACKET;
+}
+
+int MpegDemux::start(FILE *out)
+{
+    for (unsigned i = 0; i < 512; i++)
+        _fp2[i] = NULL;
+
+    _ext = mpeg_sum_open(out, &_sum_out, 0);
+
+    if (_ext == NULL)
+        return 1;
+
+    if (_options->framed() && _partial == 0)
+        if (fwrite(MPEG_FRAME_MAGIC, 1, MPEG_FRAME_START, _ext) != MPEG_FRAME_START)
+            return 1;
+
+    return 0;
+}
+
+int MpegDemux::finish(int r)
+{
     close();
 
+    // partial stream files are collected by demux_merge()
+    if (_partial)
+        return r;
+
     for (unsigned i = 0; i < 512; i++)
+        if (_fp2[i] != NULL && _fp2[i] != _ext)
+            if (fclose(_fp2[i]) && _summed)
+                r = 1;
+
+    if (_summed)
+    {
+        if (fclose(_ext))
+            r = 1;
+
+        _ext = NULL;
+        mpeg_print_stats(this, stderr);
+    }
+
+    return r;
+}
+
+int MpegDemux::demux(FILE *inp, FILE *out)
+{
+    if (start(out))
+        return 1;
+
+    return finish(parse(this));
+}
+
+// collect the outputs of partial demuxes in input order
+int MpegDemux::demux_merge(MpegDemux **part, unsigned n, FILE *out)
+{
+    int r = 0;
+
+    for (unsigned i = 0; i < 512; i++)
+        _fp2[i] = NULL;
+
+    _ext = mpeg_sum_open(out, &_sum_out, 0);
+
+    if (_ext == NULL)
+        return 1;
+
+    out = _ext;
+
+    if (_options->framed())
+        if (fwrite(MPEG_FRAME_MAGIC, 1, MPEG_FRAME_START, out) != MPEG_FRAME_START)
+            r = 1;
+
+    for (unsigned p = 0; p < n; p++)
+    {
+        if (mpeg_append(out, part[p]->_ext))
+            r = 1;
+
+        mpeg_add_stats(part[p]);
+    }
+
+    for (unsigned i = 0; i < 512; i++)
+    {
+        for (unsigned p = 0; p < n; p++)
+        {
+            FILE *fp = part[p]->_fp2[i];
+
+            if (fp == NULL || fp == part[p]->_ext)
+                continue;
+
+            if (_fp2[i] == NULL && r == 0)
+            {
+                _fp2[i] = mpeg_demux_open(this, i < 256 ? i : 0xbd, i & 0xff);
+
+                if (_fp2[i] == NULL)
+                    r = 1;
+            }
+
+            if (_fp2[i] != NULL && mpeg_append(_fp2[i], fp))
+                r = 1;
+
+            fclose(fp);
+            part[p]->_fp2[i] = NULL;
+        }
+
         if (_fp2[i] != NULL && _fp2[i] != out)
-            fclose(_fp2[i]);
+            if (fclose(_fp2[i]) && _summed)
+                r = 1;
+    }
+
+    if (_summed)
+    {
+        if (fclose(out))
+            r = 1;
+
+        _ext = NULL;
+        mpeg_print_stats(this, stderr);
+    }
 
     return r;
 }
@@ -86,16 +510,59 @@ int mpeg_demux_t::packet_check(mpeg_demux_t *)
 
 int mpeg_demux_t::mpeg_stream_excl(uint8_t sid, uint8_t ssid)
 {
-    if ((_options->_par_stream[sid] & PAR_STREAM_SELECT) == 0)
+    if ((_options->_par_stream[sid] & PAR_STREAM_SELECT) == 0 || _deselect[sid])
         return 1;
 
     if (sid == 0xbd)
-        if ((_options->_par_substream[ssid] & PAR_STREAM_SELECT) == 0)
+        if ((_options->_par_substream[ssid] & PAR_STREAM_SELECT) == 0 || _deselect[256 + ssid])
             return 1;
 
     return 0;
 }
 
+/*
+ * Packets are selected by their PTS, or by the last PTS of their stream
+ * or the time of their pack if they have none. A stream is in the
+ * window from its first PTS at or after the start, and past it once a
+ * decode time is past the end, as presentation times can go back. The
+ * states are no PTS yet, before the window, in it and past it.
+ */
+int mpeg_demux_t::mpeg_window_excl(unsigned sid, unsigned ssid)
+{
+    if (_window == 0)
+        return 0;
+
+    unsigned i = sid == 0xbd ? 256 + ssid : sid;
+    uint64_t t = _window_state[i] != 0 ? _window_time[i] : _window_pack;
+
+    if (_packet.have_pts)
+    {
+        t = mpeg_clock_time(&_clock, _packet.pts);
+        uint64_t dts = _packet.have_dts ? mpeg_clock_time(&_clock, _packet.dts) : t;
+        _window_time[i] = t;
+
+        if (_window_state[i] == 0)
+            _window_state[i] = 1;
+
+        if (_window_state[i] == 1 && t >= _options->time_from())
+        {
+            _window_state[i] = 2;
+            _window_live += 1;
+        }
+
+        if (dts > _options->time_to() && _window_state[i] == 2)
+        {
+            _window_state[i] = 3;
+            _window_live -= 1;
+
+            if (_window_live == 0)
+                _window_end = 1;
+        }
+    }
+
+    return t < _options->time_from() || t > _options->time_to();
+}
+
 void MpegList::mpeg_list_print_skip(FILE *fp)
 {
     if (_skip_cnt2 > 0)
@@ -116,67 +583,301 @@ int MpegList::skip()
     return 0;
 }
 
-int MpegList::list(FILE *inp, FILE *out)
+int MpegList::start(FILE *out)
 {
     _skip_cnt2 = 0;
     _skip_ofs2 = 0;
     _ext = out;
-    int r = parse(this);
-    mpeg_list_print_skip(out);
-    mpeg_print_stats(this, out);
+    return 0;
+}
+
+int MpegList::finish(int r)
+{
+    mpeg_list_print_skip(_ext);
+
+    if (_partial == 0)
+        mpeg_print_stats(this, _ext);
+
     close();
     return r;
 }
 
-int MpegRemux::packet()
+int MpegList::list(FILE *inp, FILE *out)
+{
+    if (start(out))
+        return 1;
+
+    return finish(parse(this));
+}
+
+// print line with the index that follows key moved up by base
+static int mpeg_list_shift(FILE *fp, const char *line, const char *key, unsigned base)
+{
+    const char *s = strstr(line, key);
+
+    if (s == NULL)
+        return 0;
+
+    s += strlen(key);
+    char *end;
+    unsigned idx = unsigned(strtoul(s, &end, 10));
+    fprintf(fp, "%.*s%u%s", int(s - line), line, idx + base, end);
+    return 1;
+}
+
+// renumber the listings of partial lists in input order
+int MpegList::list_merge(MpegList **part, unsigned n, FILE *out)
+{
+    char line[512];
+    _ext = out;
+
+    for (unsigned p = 0; p < n; p++)
+    {
+        FILE *fp = part[p]->_ext;
+
+        if (fseeko(fp, 0, SEEK_SET))
+            return 1;
+
+        while (fgets(line, sizeof(line), fp) != NULL)
+        {
+            const char *s = strstr(line, ": sid=");
+            unsigned sid = s != NULL ? unsigned(strtoul(s + 6, NULL, 16)) & 0xff : 0;
+
+            if (mpeg_list_shift(out, line, ": packet[", streams[sid].packet_cnt))
+                continue;
+
+            if (mpeg_list_shift(out, line, ": pack[", _pack_cnt))
+                continue;
+
+            if (mpeg_list_shift(out, line, ": system header[", _shdr_cnt))
+                continue;
+
+            fputs(line, out);
+        }
+
+        mpeg_add_stats(part[p]);
+    }
+
+    mpeg_print_stats(this, out);
+    return 0;
+}
+
+int MpegRemux::packet()
+{
+    uint32_t sid = _packet.sid;
+    uint32_t ssid = _packet.ssid;
+
+    if (mpeg_stream_excl(sid, ssid) || mpeg_window_excl(sid, ssid))
+        return 0;
+
+    if (sid == 0xbe && _options->compact())
+        return 0;
+
+    uint64_t ofs = _ofs;
+
+    if (_clone.active() && ofs + _packet.size <= _size)
+    {
+        // the payload is never read, only the stream ids get patched
+        if (mpeg_remux_put(&_pack_buf, _pack_ofs))
+            return 1;
+
+        if (_clone.copy(ofs, _packet.size))
+            return 1;
+
+        if (_options->_par_stream_map[sid] != sid)
+            if (_clone.patch(ofs + 3, _options->_par_stream_map[sid]))
+                return 1;
+
+        if (sid == 0xbd && _packet.offset < _packet.size)
+            if (_options->_par_substream_map[ssid] != ssid)
+                if (_clone.patch(ofs + _packet.offset, _options->_par_substream_map[ssid]))
+                    return 1;
+
+        return 0;
+    }
+
+    int r = 0;
+
+    if (mpeg_buf_read(&_packet_buf, _packet.size))
+    {
+        fprintf(stderr, "remux: incomplete packet (sid=%02x size=%u/%u)\n",
+            sid, _packet_buf.cnt, _packet.size);
+
+        if (_options->drop())
+        {
+            _packet_buf.clear();
+            return 1;
+        }
+
+        r = 1;
+    }
+
+    if (_packet_buf.cnt >= 4)
+    {
+        _packet_buf.buf[3] = _options->_par_stream_map[sid];
+
+        if (sid == 0xbd && _packet_buf.cnt > _packet.offset)
+            _packet_buf.buf[_packet.offset] = _options->_par_substream_map[ssid];
+    }
+
+    if (_options->checksum())
+    {
+        mpeg_sum_add(&_sum[sid], _packet_buf.buf, _packet_buf.cnt);
+
+        if (sid == 0xbd)
+            mpeg_sum_add(&_sum[256 + ssid], _packet_buf.buf, _packet_buf.cnt);
+    }
+
+    if (_options->compact())
+    {
+        if (mpeg_remux_compact_start())
+            return 1;
+
+        if (_stage.append(_packet_buf.buf, _packet_buf.cnt))
+            return 1;
+
+        _packet_buf.clear();
+        return r;
+    }
+
+    if (mpeg_remux_put(&_pack_buf, _pack_ofs))
+        return 1;
+
+    if (_clone.active())
+    {
+        if (_clone.write(_packet_buf.buf, _packet_buf.cnt))
+            return 1;
+
+        _packet_buf.clear();
+    }
+    else if (_packet_buf.write_clear(_ext))
+    {
+        return 1;
+    }
+
+    return r;
+}
+
+int MpegRemux::pack()
+{
+    _pack_ofs = _ofs;
+    _pack_staged = 0;
+
+    if (mpeg_buf_read(&_pack_buf, _pack.size))
+        return 1;
+
+    if (_options->compact())
+        return 0;
+
+    if (_options->empty_pack() && _window_out == 0)
+        if (mpeg_remux_put(&_pack_buf, _pack_ofs))
+            return 1;
+
+    return 0;
+}
+
+// write buffered input bytes that start at input offset ofs unchanged
+int MpegRemux::mpeg_remux_put(mpeg_buffer_t *buf, uint64_t ofs)
 {
-    uint32_t sid = _packet.sid;
-    uint32_t ssid = _packet.ssid;
+    if (_clone.active() == 0)
+        return buf->write_clear(_ext);
 
-    if (mpeg_stream_excl(sid, ssid))
-        return 0;
+    uint32_t cnt = buf->cnt;
+    buf->clear();
 
-    int r = 0;
+    if (cnt > 0)
+        return _clone.copy(ofs, cnt);
 
-    if (mpeg_buf_read(&_packet_buf, _packet.size))
-    {
-        fprintf(stderr, "remux: incomplete packet (sid=%02x size=%u/%u)\n",
-            sid, _packet_buf.cnt, _packet.size);
+    return 0;
+}
 
-        if (_options->drop())
-        {
-            _packet_buf.clear();
-            return 1;
-        }
+int MpegRemux::mpeg_remux_clone(FILE *out)
+{
+    // compacted packs are modified and checksums need the data, so they can't be cloned
+    if (_options->clone() == 0 || _options->compact() || _options->checksum())
+        return 0;
 
-        r = 1;
+    if (_clone.open(_fp, out))
+    {
+        fprintf(stderr, "remux: can't clone into output, copying instead\n");
+        return 1;
     }
 
-    if (_packet_buf.cnt >= 4)
+    return 0;
+}
+
+static void mpeg_set_bits(uint8_t *buf, unsigned i, unsigned n, uint32_t val)
+{
+    while (n > 0)
     {
-        _packet_buf.buf[3] = _options->_par_stream_map[sid];
+        n -= 1;
+        uint8_t m = 0x80 >> (i & 7);
 
-        if (sid == 0xbd && _packet_buf.cnt > _packet.offset)
-            _packet_buf.buf[_packet.offset] = _options->_par_substream_map[ssid];
+        if ((val >> n) & 1)
+            buf[i >> 3] |= m;
+        else
+            buf[i >> 3] &= ~m;
+
+        i += 1;
     }
+}
+
+// start staging the current pack, once it has something to carry
+int MpegRemux::mpeg_remux_compact_start()
+{
+    if (_pack_staged)
+        return 0;
 
-    if (_pack_buf.write_clear(_ext))
+    if (mpeg_remux_compact_flush(1, _pack.scr))
         return 1;
 
-    if (_packet_buf.write_clear(_ext))
+    _pack_staged = 1;
+    _stage_scr = _pack.scr;
+    _stage_mux = _pack.mux_rate;
+    _stage_type = _pack.type;
+    uint32_t cnt = _pack_buf.cnt;
+
+    // drop the pack stuffing bytes
+    if (_pack.type == 2 && cnt > 14)
+    {
+        cnt = 14;
+        _pack_buf.buf[13] &= 0xf8;
+    }
+
+    if (_stage.append(_pack_buf.buf, cnt))
         return 1;
 
-    return r;
+    _pack_buf.clear();
+    return 0;
 }
 
-int MpegRemux::pack()
+/*
+ * Write the staged pack. Its mux rate is lowered to what is needed to
+ * deliver the remaining bytes before the next pack's SCR.
+ */
+int MpegRemux::mpeg_remux_compact_flush(int have_next, uint64_t next_scr)
 {
-    if (mpeg_buf_read(&_pack_buf, _pack.size))
-        return 1;
+    if (_stage.cnt == 0)
+        return 0;
 
-    if (_options->empty_pack())
-        if (_pack_buf.write_clear(_ext))
-            return 1;
+    uint64_t dscr = (next_scr - _stage_scr) & 0x1ffffffffULL;
+
+    // large jumps are discontinuities, keep the original rate there
+    if (have_next && _stage_type != 0 && dscr > 0 && dscr < 90000)
+    {
+        uint64_t rate = (uint64_t(_stage.cnt) * 1800 + dscr - 1) / dscr;
+
+        if (rate < _stage_mux)
+        {
+            if (_stage_type == 2)
+                mpeg_set_bits(_stage.buf, 80, 22, uint32_t(rate));
+            else
+                mpeg_set_bits(_stage.buf, 73, 22, uint32_t(rate));
+        }
+    }
+
+    if (_stage.write_clear(_ext))
+        return 1;
 
     return 0;
 }
@@ -213,6 +914,29 @@ char *mpeg_demux_t::mpeg_get_name(const char *base, unsigned sid)
     return ret;
 }
 
+FILE *mpeg_demux_t::mpeg_open_output(const char *name)
+{
+    FILE *fp;
+
+    if (_options->direct())
+        fp = mpeg_direct_t::open(name);
+    else
+        fp = fopen(name, "wb");
+
+    // cloned output needs the real file descriptor
+    if (fp != NULL && _options->threads() && _options->clone() == 0)
+    {
+        FILE *ret = mpeg_writer_t::open(fp, 1);
+
+        if (ret == NULL)
+            fclose(fp);
+
+        return ret;
+    }
+
+    return fp;
+}
+
 FILE *MpegDemux::mpeg_demux_open(mpeg_demux_t *, unsigned sid, unsigned ssid)
 {
     FILE *fp;
@@ -221,26 +945,35 @@ FILE *MpegDemux::mpeg_demux_open(mpeg_demux_t *, unsigned sid, unsigned ssid)
     {
         fp = _ext;
     }
+    else if (_partial)
+    {
+        fp = tmpfile();
+
+        if (fp == NULL)
+            return NULL;
+    }
     else
     {
         uint32_t seq = sid == 0xbd ? (sid << 8) + ssid : sid;
         char *name = mpeg_get_name(_options->_demux_name, seq);
-        fp = fopen(name, "wb");
+        fp = mpeg_open_output(name);
 
         if (fp == NULL)
         {
             fprintf(stderr, "can't open stream file (%s)\n", name);
 
-            if (sid == 0xbd)
-                _options->_par_substream[ssid] &= ~PAR_STREAM_SELECT;
-            else
-                _options->_par_stream[sid] &= ~PAR_STREAM_SELECT;
+            // only for this instance, the options are shared
+            _deselect[sid == 0xbd ? 256 + ssid : sid] = 1;
 
             free(name);
             return NULL;
         }
 
         free(name);
+        fp = mpeg_sum_open(fp, &_sum[sid == 0xbd ? 256 + ssid : sid], 1);
+
+        if (fp == NULL)
+            return NULL;
     }
 
     if (sid == 0xbd && _options->dvdsub())
@@ -260,7 +993,7 @@ int MpegDemux::packet()
     uint32_t sid = _packet.sid;
     uint32_t ssid = _packet.ssid;
 
-    if (mpeg_stream_excl(sid, ssid))
+    if (mpeg_stream_excl(sid, ssid) || mpeg_window_excl(sid, ssid))
         return 0;
 
     uint32_t cnt = _packet.offset;
@@ -284,6 +1017,14 @@ int MpegDemux::packet()
         return 1;
     }
 
+    if (_options->framed())
+    {
+        if (cnt > 0)
+            mpegd_skip(this, cnt);
+
+        return mpeg_demux_frame(_packet.size - cnt);
+    }
+
     if (_fp2[fpi] == NULL)
     {
         _fp2[fpi] = mpeg_demux_open(this, sid, ssid);
@@ -296,9 +1037,16 @@ int MpegDemux::packet()
         mpegd_skip(this, cnt);
 
     cnt = _packet.size - cnt;
+    return mpeg_demux_write(_fp2[fpi], cnt);
+}
+
+// write the next cnt payload bytes of the current packet
+int MpegDemux::mpeg_demux_write(FILE *fp, unsigned cnt)
+{
+    uint32_t sid = _packet.sid;
 
     if (sid == 0xbd && _options->dvdsub())
-        return mpeg_demux_copy_spu(this, _fp2[fpi], cnt);
+        return mpeg_demux_copy_spu(this, fp, cnt);
 
     int r = 0;
 
@@ -316,13 +1064,53 @@ int MpegDemux::packet()
         r = 1;
     }
 
-    if (_packet_buf.write_clear(_fp2[fpi]))
+    if (_packet_buf.write_clear(fp))
         r = 1;
 
     return r;
 }
 
-int MpegRemux::remux(FILE *inp, FILE *out)
+// write the payload of the current packet as a frame to the output
+int MpegDemux::mpeg_demux_frame(unsigned cnt)
+{
+    int r = 0;
+
+    if (mpeg_buf_read(&_packet_buf, cnt))
+    {
+        fprintf(stderr, "demux: incomplete packet (sid=%02x size=%u/%u)\n",
+            _packet.sid, _packet_buf.cnt, cnt);
+
+        if (_options->drop())
+        {
+            _packet_buf.clear();
+            return 1;
+        }
+
+        r = 1;
+    }
+
+    uint8_t hdr[MPEG_FRAME_HEADER];
+    mpeg_frame_set(hdr, &_packet, _packet_buf.cnt);
+
+    if (fwrite(hdr, 1, MPEG_FRAME_HEADER, _ext) != MPEG_FRAME_HEADER)
+        return 1;
+
+    if (_packet_buf.write_clear(_ext))
+        r = 1;
+
+    return r;
+}
+
+// everything but the payload of dropped streams, skipped bytes have no unit
+unsigned MpegRemux::index_units()
+{
+    if (_options->remux_skipped())
+        return 0;
+
+    return 1 << MPEG_INDEX_PACK | 1 << MPEG_INDEX_SHDR | 1 << MPEG_INDEX_PACKET | 1 << MPEG_INDEX_END;
+}
+
+int MpegRemux::start(FILE *out)
 {
     if (_options->split())
     {
@@ -334,15 +1122,27 @@ int MpegRemux::remux(FILE *inp, FILE *out)
     }
     else
     {
-        _ext = out;
+        _ext = mpeg_sum_open(out, &_sum_out, 0);
+
+        if (_ext == NULL)
+            return 1;
+
+        mpeg_remux_clone(_ext);
     }
 
     _shdr_buf.init();
     _pack_buf.init();
     _packet_buf.init();
-    int r = parse(this);
+    _stage.init();
+    return 0;
+}
 
-    if (_options->no_end())
+int MpegRemux::finish(int r)
+{
+    if (mpeg_remux_compact_flush(0, 0))
+        r = 1;
+
+    if (_options->no_end() && _partial == 0)
     {
         uint8_t buf[4];
         buf[0] = MPEG_END_CODE >> 24 & 0xff;
@@ -350,35 +1150,126 @@ int MpegRemux::remux(FILE *inp, FILE *out)
         buf[2] = MPEG_END_CODE >> 8 & 0xff;
         buf[3] = MPEG_END_CODE & 0xff;
 
-        if (fwrite(buf, 1, 4, _ext) != 4)
+        if (_clone.active())
+        {
+            if (_clone.write(buf, 4))
+                r = 1;
+        }
+        else if (fwrite(buf, 1, 4, _ext) != 4)
+        {
             r = 1;
+        }
     }
 
-    if (_options->split())
+    if (_clone.close())
+        r = 1;
+
+    if (_options->split() || _summed)
     {
-        fclose(_ext);
+        if (fclose(_ext) && _summed)
+            r = 1;
+
         _ext = NULL;
     }
 
+    if (_summed)
+        mpeg_print_stats(this, stderr);
+
     close();
     _shdr_buf.free();
     _pack_buf.free();
     _packet_buf.free();
+    _stage.free();
+    return r;
+}
+
+int MpegRemux::remux(FILE *inp, FILE *out)
+{
+    if (start(out))
+        return 1;
+
+    return finish(parse(this));
+}
+
+// concatenate partial remuxes in input order
+int MpegRemux::remux_merge(MpegRemux **part, unsigned n, FILE *out)
+{
+    int r = 0;
+    _ext = mpeg_sum_open(out, &_sum_out, 0);
+
+    if (_ext == NULL)
+        return 1;
+
+    for (unsigned p = 0; p < n && r == 0; p++)
+    {
+        if (mpeg_append(_ext, part[p]->_ext))
+            r = 1;
+
+        mpeg_add_stats(part[p]);
+
+        // the parts summed their packets, join the sums in order
+        for (unsigned i = 0; i < 512; i++)
+            mpeg_sum_cat(&_sum[i], &part[p]->_sum[i]);
+    }
+
+    if (_options->no_end() && r == 0)
+    {
+        uint8_t buf[4];
+        buf[0] = MPEG_END_CODE >> 24 & 0xff;
+        buf[1] = MPEG_END_CODE >> 16 & 0xff;
+        buf[2] = MPEG_END_CODE >> 8 & 0xff;
+        buf[3] = MPEG_END_CODE & 0xff;
+
+        if (fwrite(buf, 1, 4, _ext) != 4)
+            r = 1;
+    }
+
+    if (_summed)
+    {
+        if (fclose(_ext))
+            r = 1;
+
+        _ext = NULL;
+        mpeg_print_stats(this, stderr);
+    }
+
     return r;
 }
 
 int MpegRemux::system_header()
 {
+    if (_window_out)
+        return 0;
+
     if (_options->no_shdr() && _shdr_cnt > 1)
         return 0;
 
-    if (_pack_buf.write_clear(_ext))
+    if (_options->compact())
+    {
+        if (_shdr_done)
+            return 0;
+
+        if (mpeg_remux_compact_start())
+            return 1;
+
+        if (mpeg_buf_read(&_shdr_buf, _shdr.size))
+            return 1;
+
+        _shdr_done = 1;
+        int r = _stage.append(_shdr_buf.buf, _shdr_buf.cnt);
+        _shdr_buf.clear();
+        return r;
+    }
+
+    if (mpeg_remux_put(&_pack_buf, _pack_ofs))
         return 1;
 
+    uint64_t ofs = _ofs;
+
     if (mpeg_buf_read(&_shdr_buf, _shdr.size))
         return 1;
 
-    if (_shdr_buf.write_clear(_ext))
+    if (mpeg_remux_put(&_shdr_buf, ofs))
         return 1;
 
     return 0;
@@ -400,28 +1291,26 @@ int MpegList::system_header()
 
 int MpegDemux::mpeg_demux_copy_spu(mpeg_demux_t *mpeg, FILE *fp, unsigned cnt)
 {
-    static unsigned spucnt = 0;
-    static int half = 0;
     unsigned i, n;
     uint8_t buf[8];
     uint64_t pts;
 
-    if (half)
+    if (_spu_half)
     {
         mpegd_read(this, buf, 1);
 
         if (fwrite(buf, 1, 1, fp) != 1)
             return 1;
 
-        spucnt = (spucnt << 8) + buf[0];
-        half = 0;
-        spucnt -= 2;
+        _spu_cnt = (_spu_cnt << 8) + buf[0];
+        _spu_half = 0;
+        _spu_cnt -= 2;
         cnt -= 1;
     }
 
     while (cnt > 0)
     {
-        if (spucnt == 0)
+        if (_spu_cnt == 0)
         {
             pts = _packet.pts;
 
@@ -441,8 +1330,8 @@ int MpegDemux::mpeg_demux_copy_spu(mpeg_demux_t *mpeg, FILE *fp, unsigned cnt)
                 if (fwrite(buf, 1, 1, fp) != 1)
                     return 1;
 
-                spucnt = buf[0];
-                half = 1;
+                _spu_cnt = buf[0];
+                _spu_half = 1;
                 return 0;
             }
 
@@ -451,19 +1340,19 @@ int MpegDemux::mpeg_demux_copy_spu(mpeg_demux_t *mpeg, FILE *fp, unsigned cnt)
             if (fwrite(buf, 1, 2, fp) != 2)
                 return 1;
 
-            spucnt = (buf[0] << 8) + buf[1];
+            _spu_cnt = (buf[0] << 8) + buf[1];
 
-            if (spucnt < 2)
+            if (_spu_cnt < 2)
                 return (1);
 
-            spucnt -= 2;
+            _spu_cnt -= 2;
             cnt -= 2;
         }
 
-        n = cnt < spucnt ? cnt : spucnt;
+        n = cnt < _spu_cnt ? cnt : _spu_cnt;
         mpeg_copy(mpeg, fp, n);
         cnt -= n;
-        spucnt -= n;
+        _spu_cnt -= n;
     }
 
     return 0;
@@ -500,7 +1389,8 @@ int MpegScan::packet()
                 return 0;
         }
 
-        if (_packet.pts < pts2[ssid])
+        // partial scans must not hide packets the merge may need
+        if (_packet.pts < pts2[ssid] && (_packet.have_pts || _partial == 0))
             pts2[ssid] = _packet.pts;
     }
     else
@@ -517,7 +1407,7 @@ int MpegScan::packet()
                 return 0;
         }
 
-        if (_packet.pts < pts1[sid])
+        if (_packet.pts < pts1[sid] && (_packet.have_pts || _partial == 0))
             pts1[sid] = _packet.pts;
     }
     
@@ -612,6 +1502,12 @@ int mpeg_demux_t::mpegd_parse_packet(mpeg_demux_t *)
 
         uint64_t ofs = _ofs + _packet.size;
 
+        if (_table != NULL)
+            mpegd_table_add(0, _packet.size);
+
+        if (_index != NULL)
+            mpegd_index_add(MPEG_INDEX_PACKET);
+
         if (packet())
             return 1;
 
@@ -637,9 +1533,14 @@ void mpeg_demux_t::mpeg_print_stats(mpeg_demux_t *mpeg, FILE *fp)
         {
             fprintf(fp,
                 "Stream %02x:      "
-                "%u packets / %" PRIuMAX " bytes\n",
+                "%u packets / %" PRIuMAX " bytes",
                 i, mpeg->streams[i].packet_cnt,
                 uintmax_t(mpeg->streams[i].size));
+
+            if (mpeg->_sum[i].len > 0)
+                fprintf(fp, " / crc32c %08x", mpeg->_sum[i].crc);
+
+            fputc('\n', fp);
         }
     }
 
@@ -648,12 +1549,23 @@ void mpeg_demux_t::mpeg_print_stats(mpeg_demux_t *mpeg, FILE *fp)
         if (mpeg->substreams[i].packet_cnt > 0)
         {
             fprintf(fp, "Substream %02x:   "
-                "%u packets / %" PRIuMAX " bytes\n",
+                "%u packets / %" PRIuMAX " bytes",
                 i, mpeg->substreams[i].packet_cnt,
                 uintmax_t(mpeg->substreams[i].size));
+
+            if (mpeg->_sum[256 + i].len > 0)
+                fprintf(fp, " / crc32c %08x", mpeg->_sum[256 + i].crc);
+
+            fputc('\n', fp);
         }
     }
 
+    if (mpeg->_summed)
+    {
+        fprintf(fp, "Output:         %" PRIuMAX " bytes / crc32c %08x\n",
+            uintmax_t(mpeg->_sum_out.len), mpeg->_sum_out.crc);
+    }
+
     fflush(fp);
 }
 
@@ -759,7 +1671,7 @@ int mpeg_demux_t::mpegd_parse_packet2(mpeg_demux_t *, unsigned i)
     return 0;
 }
 
-int mpeg_demux_t::mpegd_parse_pack(mpeg_demux_t *mpeg)
+int mpeg_demux_t::mpegd_parse_pack_header(mpeg_demux_t *mpeg)
 {
     if (mpegd_get_bits(32, 4) == 0x02)
     {
@@ -789,13 +1701,39 @@ int mpeg_demux_t::mpegd_parse_pack(mpeg_demux_t *mpeg)
         _pack.size = 4;
     }
 
+    if (_window)
+    {
+        mpegd_window_pack();
+
+        // the packets in this pack and after it are too late
+        if (_window_end)
+            return 0;
+    }
+
     uint64_t ofs = _ofs + _pack.size;
     _pack_cnt += 1;
 
+    if (_table != NULL)
+        mpegd_table_add(MPEG_TABLE_PACK, _pack.size);
+
+    if (_index != NULL)
+        mpegd_index_add(MPEG_INDEX_PACK);
+
     if (mpeg->pack())
         return 1;
 
     mpegd_set_offset(this, ofs);
+    return 0;
+}
+
+int mpeg_demux_t::mpegd_parse_pack(mpeg_demux_t *mpeg)
+{
+    if (mpegd_parse_pack_header(mpeg))
+        return 1;
+
+    if (_window_end)
+        return 0;
+
     mpegd_seek_header();
 
     if (mpegd_get_bits(0, 32) == MPEG_SYSTEM_HEADER)
@@ -806,7 +1744,7 @@ int mpeg_demux_t::mpegd_parse_pack(mpeg_demux_t *mpeg)
         mpegd_seek_header();
     }
 
-    while (mpegd_get_bits(0, 24) == MPEG_PACKET_START)
+    while (_window_end == 0 && mpegd_get_bits(0, 24) == MPEG_PACKET_START)
     {
         uint32_t sid = mpegd_get_bits(24, 8);
 
@@ -828,6 +1766,9 @@ int mpeg_demux_t::mpegd_parse_system_header()
     _shdr_cnt += 1;
     uint64_t ofs = _ofs + _shdr.size;
 
+    if (_index != NULL)
+        mpegd_index_add(MPEG_INDEX_SHDR);
+
     if (system_header())
         return 1;
 
@@ -851,12 +1792,26 @@ int mpeg_demux_t::mpegd_skip(mpeg_demux_t *mpeg, unsigned n)
     _buf_i = 0;
     _buf_n = 0; 
 
+    if (_seekable)
+    {
+        // don't read data that nobody looks at
+        uint64_t pos = _ofs - n;
+
+        if (pos > _size)
+            pos = _size;
+
+        if (fseeko(_fp, off_t(n < _size - pos ? pos + n : _size), SEEK_SET))
+            return 1;
+
+        return n > _size - pos ? 1 : 0;
+    }
+
     while (n > 0)
     {
         if (n <= MPEG_DEMUX_BUFFER)
-            r = fread(this->buf, 1, n, _fp);
+            r = mpegd_fread(this->buf, n);
         else
-            r = fread(this->buf, 1, MPEG_DEMUX_BUFFER, _fp);
+            r = mpegd_fread(this->buf, MPEG_DEMUX_BUFFER);
 
         if (r <= 0)
             return 1;
@@ -881,12 +1836,46 @@ int MpegList::pack()
         _pack.mux_rate, 50.0 * _pack.mux_rate,
         _pack.stuff);
 
-    fflush(_ext);
-    return 0;
+    fflush(_ext);
+    return 0;
+}
+
+int MpegScan::start(FILE *out)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        pts1[i] = 0xffffffffffffffff;
+        pts2[i] = 0xffffffffffffffff;
+    }
+
+    _ext = out;
+    return 0;
+}
+
+int MpegScan::finish(int r)
+{
+    if (_partial == 0)
+        mpeg_print_stats(this, _ext);
+
+    close();
+    return r;
+}
+
+int MpegScan::scan(FILE *inp, FILE *out)
+{
+    if (start(out))
+        return 1;
+
+    return finish(parse(this));
 }
 
-int MpegScan::scan(FILE *inp, FILE *out)
+// keep the lines of partial scans that a single scan would have printed
+int MpegScan::scan_merge(MpegScan **part, unsigned n, FILE *out)
 {
+    char line[512];
+    uint8_t seen[512];
+    memset(seen, 0, sizeof(seen));
+
     for (uint32_t i = 0; i < 256; i++)
     {
         pts1[i] = 0xffffffffffffffff;
@@ -894,10 +1883,50 @@ int MpegScan::scan(FILE *inp, FILE *out)
     }
 
     _ext = out;
-    int r = parse(this);
+
+    for (unsigned p = 0; p < n; p++)
+    {
+        FILE *fp = part[p]->_ext;
+
+        if (fseeko(fp, 0, SEEK_SET))
+            return 1;
+
+        while (fgets(line, sizeof(line), fp) != NULL)
+        {
+            const char *s = strstr(line, ": sid=");
+
+            if (s == NULL || strstr(line, "incomplete packet") != NULL)
+            {
+                fputs(line, out);
+                continue;
+            }
+
+            unsigned sid = unsigned(strtoul(s + 6, NULL, 16)) & 0xff;
+            unsigned ssid = sid == 0xbd ? unsigned(strtoul(s + 9, NULL, 16)) & 0xff : 0;
+            const char *t = strstr(s, " pts=");
+            uint64_t pts = t != NULL ? strtoull(t + 5, NULL, 10) : 0;
+            uint64_t *min = sid == 0xbd ? &pts2[ssid] : &pts1[sid];
+            unsigned fpi = sid == 0xbd ? 256 + ssid : sid;
+
+            if (seen[fpi])
+            {
+                if (_options->first_pts() == 0 || t == NULL || pts >= *min)
+                    continue;
+            }
+
+            seen[fpi] = 1;
+
+            if (pts < *min)
+                *min = pts;
+
+            fputs(line, out);
+        }
+
+        mpeg_add_stats(part[p]);
+    }
+
     mpeg_print_stats(this, out);
-    close();
-    return r;
+    return 0;
 }
 
 int mpeg_demux_t::mpegd_seek_header()
@@ -1011,9 +2040,22 @@ int mpeg_demux_t::mpegd_parse_packet1(mpeg_demux_t *mpeg, unsigned i)
 
 int MpegRemux::skip()
 {
-    if (_options->remux_skipped() == 0)
+    if (_options->remux_skipped() == 0 || _window_out)
         return 0;
 
+    if (_clone.active())
+        return _ofs < _size ? _clone.copy(_ofs, 1) : 1;
+
+    if (_stage.cnt > 0)
+    {
+        uint8_t c;
+
+        if (mpegd_read(this, &c, 1) != 1)
+            return 1;
+
+        return _stage.append(&c, 1);
+    }
+
     if (mpeg_copy(this, _ext, 1))
         return 1;
 
@@ -1054,11 +2096,21 @@ int mpeg_demux_t::mpeg_copy(mpeg_demux_t *, FILE *fp, unsigned n)
 
 int MpegRemux::end()
 {
-    if (_options->no_end())
+    if (_options->no_end() || _window_out)
         return 0;
 
-    if (mpeg_copy(this, _ext, 4))
+    if (mpeg_remux_compact_flush(0, 0))
+        return 1;
+
+    if (_clone.active())
+    {
+        if (_clone.copy(_ofs, 4))
+            return 1;
+    }
+    else if (mpeg_copy(this, _ext, 4))
+    {
         return 1;
+    }
 
     if (_options->split())
         if (mpeg_remux_next_fp(this))
@@ -1093,7 +2145,7 @@ int mpeg_demux_t::_mpegd_buffer_fill(mpeg_demux_t *mpeg)
     
     if (n > 0)
     {
-        size_t r = fread(this->buf + _buf_n, 1, n, _fp);
+        size_t r = mpegd_fread(this->buf + _buf_n, n);
     
         if (r < 0)
             return 1;
@@ -1122,6 +2174,39 @@ int mpeg_demux_t::mpegd_set_offset(mpeg_demux_t *mpeg, uint64_t ofs)
     return 1;
 }
 
+size_t mpeg_demux_t::mpegd_fread(void *buf, size_t n)
+{
+    // fan-out handlers have no input file of their own
+    if (_fp == NULL)
+    {
+        if (n > _src_n)
+            n = _src_n;
+
+        if (n > 0)
+            memcpy(buf, _src, n);
+
+        _src += n;
+        _src_n -= uint32_t(n);
+        return n;
+    }
+
+    if (_reader_on)
+        return _reader.read(buf, n);
+
+    return fread(buf, 1, n, _fp);
+}
+
+int mpeg_demux_t::mpegd_seek(uint64_t ofs)
+{
+    if (fseeko(_fp, off_t(ofs), SEEK_SET))
+        return 1;
+
+    _ofs = ofs;
+    _buf_i = 0;
+    _buf_n = 0;
+    return 0;
+}
+
 unsigned mpeg_demux_t::mpegd_read(mpeg_demux_t *, void *buf, unsigned n)
 {
     uint8_t *tmp = (uint8_t *)buf;
@@ -1138,19 +2223,437 @@ unsigned mpeg_demux_t::mpegd_read(mpeg_demux_t *, void *buf, unsigned n)
     }
 
     if (n > 0)
-        ret += fread(tmp, 1, n, _fp);
+        ret += mpegd_fread(tmp, n);
 
     _ofs += ret;
     return ret;
 }
 
-int mpeg_demux_t::parse(mpeg_demux_t *mpeg)
+// publish the current pack or packet, a failed table is dropped
+void mpeg_demux_t::mpegd_table_add(uint8_t flags, uint32_t size)
+{
+    mpeg_table_entry_t ent;
+    ent.ofs = _ofs;
+    ent.scr = _pack.scr;
+    ent.size = size;
+    ent.flags = flags;
+
+    if (flags & MPEG_TABLE_PACK)
+    {
+        ent.pts = 0;
+        ent.dts = 0;
+        ent.sid = 0xba;
+        ent.ssid = 0;
+        ent.type = uint8_t(_pack.type);
+    }
+    else
+    {
+        ent.pts = _packet.pts;
+        ent.dts = _packet.dts;
+        ent.sid = uint8_t(_packet.sid);
+        ent.ssid = uint8_t(_packet.ssid);
+        ent.type = uint8_t(_packet.type);
+
+        if (_packet.have_pts)
+            ent.flags |= MPEG_TABLE_PTS;
+
+        if (_packet.have_dts)
+            ent.flags |= MPEG_TABLE_DTS;
+    }
+
+    if (_table->add(&ent))
+    {
+        fprintf(stderr, "can't add to packet table\n");
+        _table->close();
+        _table = NULL;
+    }
+}
+
+// record the current unit, a failed index is dropped
+void mpeg_demux_t::mpegd_index_add(uint8_t kind)
+{
+    mpeg_index_entry_t ent;
+    memset(&ent, 0, sizeof(ent));
+    ent.kind = kind;
+    ent.ofs = _ofs;
+    ent.skip = _skip_cnt;
+
+    if (kind == MPEG_INDEX_PACK)
+    {
+        ent.type = uint8_t(_pack.type);
+        ent.stuff = uint8_t(_pack.stuff);
+        ent.scr = _pack.scr;
+        ent.mux_rate = _pack.mux_rate;
+    }
+    else if (kind == MPEG_INDEX_SHDR)
+    {
+        ent.size = _shdr.size;
+        ent.fixed = uint8_t(_shdr.fixed);
+        ent.csps = uint8_t(_shdr.csps);
+    }
+    else if (kind == MPEG_INDEX_PACKET)
+    {
+        ent.sid = uint8_t(_packet.sid);
+        ent.ssid = uint8_t(_packet.ssid);
+        ent.size = _packet.size;
+        ent.offset = _packet.offset;
+        ent.type = uint8_t(_packet.type);
+        ent.pts = _packet.pts;
+        ent.dts = _packet.dts;
+
+        if (_packet.have_pts)
+            ent.flags |= MPEG_INDEX_PTS;
+
+        if (_packet.have_dts)
+            ent.flags |= MPEG_INDEX_DTS;
+
+        // an access unit starts where the PTS is, with the sequence
+        // and GOP headers in front of the picture
+        if (ent.sid >= 0xe0 && ent.sid < 0xf0 && _packet.have_pts)
+        {
+            unsigned n = ent.size < MPEG_DEMUX_BUFFER ? ent.size : MPEG_DEMUX_BUFFER;
+            _mpegd_need_bits(8 * n);
+            n = n < _buf_n ? n : _buf_n;
+
+            if (n > ent.offset && mpeg_index_key(buf + _buf_i + ent.offset, n - ent.offset))
+                ent.flags |= MPEG_INDEX_KEY;
+        }
+    }
+
+    if (_index->add(&ent))
+    {
+        fprintf(stderr, "can't add to index\n");
+        _index->close();
+        _index = NULL;
+    }
+}
+
+// the index has the units of a parse without packet checks
+int mpeg_demux_t::mpegd_index_usable()
+{
+    if (_options->packet_max() > 0)
+        return 0;
+
+    for (unsigned i = 0; i < 256; i++)
+        if (_options->_par_stream[i] & PAR_STREAM_INVALID)
+            return 0;
+
+    return 1;
+}
+
+// count a unit that isn't read, as the parser would have
+void mpeg_demux_t::mpegd_index_stats(const mpeg_index_entry_t *ent)
+{
+    switch (ent->kind)
+    {
+    case MPEG_INDEX_PACK:
+        _pack.type = ent->type;
+        _pack.scr = ent->scr;
+        _pack.mux_rate = ent->mux_rate;
+        _pack.stuff = ent->stuff;
+        _pack.size = ent->size;
+        _pack_cnt += 1;
+        break;
+    case MPEG_INDEX_SHDR:
+        _shdr.size = ent->size;
+        _shdr.fixed = ent->fixed;
+        _shdr.csps = ent->csps;
+        _shdr_cnt += 1;
+        break;
+    case MPEG_INDEX_PACKET:
+        _packet_cnt += 1;
+        streams[ent->sid].packet_cnt += 1;
+        streams[ent->sid].size += ent->size - ent->offset;
+
+        if (ent->sid == 0xbd)
+        {
+            substreams[ent->ssid].packet_cnt += 1;
+            substreams[ent->ssid].size += ent->size - ent->offset;
+        }
+
+        break;
+    case MPEG_INDEX_END:
+        _end_cnt += 1;
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Parse from the index instead of the input. Units the mode doesn't
+ * need are only counted, the others are parsed at their offset with
+ * the usual code, so the handlers see what a full parse would show.
+ */
+int mpeg_demux_t::mpegd_parse_index(mpeg_index_t *index)
+{
+    mpeg_index_entry_t ent;
+    unsigned units = index_units();
+    int r;
+
+    while ((r = index->next(&ent)) == 0)
+    {
+        _skip_cnt = ent.skip;
+        int need = (units >> ent.kind) & 1;
+
+        if (need && ent.kind == MPEG_INDEX_PACKET)
+            need = mpeg_stream_excl(ent.sid, ent.ssid) == 0;
+
+        if (need == 0)
+        {
+            mpegd_index_stats(&ent);
+            continue;
+        }
+
+        if (ent.ofs >= _ofs ? mpegd_set_offset(this, ent.ofs) : mpegd_seek(ent.ofs))
+            return 1;
+
+        if (mpegd_get_bits(0, 24) != MPEG_PACKET_START)
+        {
+            fprintf(stderr, "index doesn't match the input (%08" PRIxMAX ")\n", uintmax_t(ent.ofs));
+            return 1;
+        }
+
+        switch (ent.kind)
+        {
+        case MPEG_INDEX_PACK:
+            if (mpegd_parse_pack_header(this))
+                return 1;
+
+            break;
+        case MPEG_INDEX_SHDR:
+            if (mpegd_parse_system_header())
+                return 1;
+
+            break;
+        case MPEG_INDEX_PACKET:
+            mpegd_parse_packet(this);
+            break;
+        case MPEG_INDEX_END:
+            _end_cnt += 1;
+
+            if (end())
+                return 1;
+
+            if (mpegd_set_offset(this, ent.ofs + 4))
+                return 1;
+
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (r < 0)
+    {
+        fprintf(stderr, "index is damaged\n");
+        return 1;
+    }
+
+    _skip_cnt = ent.skip;
+    return 0;
+}
+
+// find the last pack at or before a time in the index
+int mpeg_demux_t::mpegd_index_time(uint64_t time, uint64_t *ofs)
+{
+    mpeg_index_t index;
+    mpeg_index_entry_t ent;
+    mpeg_clock_t clk;
+    int found = 0;
+    int r;
+
+    if (_options->_inp_name == NULL || index.open(_options->_inp_name, _fp))
+        return 1;
+
+    while ((r = index.next(&ent)) == 0)
+    {
+        if (ent.kind != MPEG_INDEX_PACK || ent.type == 0)
+            continue;
+
+        if (found == 0)
+            mpeg_clock_init(&clk, ent.scr);
+
+        // the time never goes back, so the first pack past it ends the search
+        mpeg_clock_t tmp = clk;
+
+        if (mpeg_clock_pack(&tmp, ent.scr) > time)
+            break;
+
+        clk = tmp;
+        *ofs = ent.ofs;
+        found = 1;
+    }
+
+    if (r < 0 || found == 0)
+        return 1;
+
+    _clock = clk;
+    return 0;
+}
+
+/*
+ * Start a time window. Packets are muxed up to a second ahead of their
+ * time stamps, so a seekable input is entered at the last pack a second
+ * before the window, found in the index or by bisection.
+ */
+int mpeg_demux_t::mpegd_window_start()
+{
+    uint64_t from = _options->time_from();
+    uint64_t ofs;
+
+    if ((_options->_par_mode != PAR_MODE_DEMUX && _options->_par_mode != PAR_MODE_REMUX)
+        || _options->_fan_cnt > 0 || _options->seek() > 0 || _partial)
+    {
+        fprintf(stderr, "can't select a time window in this mode\n");
+        return 1;
+    }
+
+    _window = 1;
+    _window_out = from > 0;
+    _window_live = 0;
+    _window_end = 0;
+    memset(_window_state, 0, sizeof(_window_state));
+
+    if (from <= MPEG_WINDOW_LEAD || _seekable == 0)
+        return 0;
+
+    if (mpegd_index_time(from - MPEG_WINDOW_LEAD, &ofs)
+        && mpeg_sync_time(fileno(_fp), _size, from - MPEG_WINDOW_LEAD, &ofs, &_clock))
+        return 0;
+
+    _clock_set = 1;
+    return mpegd_seek(ofs);
+}
+
+void mpeg_demux_t::mpegd_window_pack()
+{
+    if (_pack.type == 0)
+        return;
+
+    if (_clock_set == 0)
+    {
+        mpeg_clock_init(&_clock, _pack.scr);
+        _clock_set = 1;
+    }
+
+    _window_pack = mpeg_clock_pack(&_clock, _pack.scr);
+    _window_out = _window_pack < _options->time_from() || _window_pack > _options->time_to();
+
+    // every packet in a later pack has a time stamp past its SCR
+    if (_window_pack > _options->time_to())
+        _window_end = 1;
+}
+
+int mpeg_demux_t::parse(mpeg_demux_t *)
+{
+    if (_range_start > 0 && mpegd_seek(_range_start))
+        return 1;
+
+    // a time is looked for on the whole input only
+    int whole = _partial == 0 && _options->seek() == 0 && _options->window() == 0;
+
+    if (_options->seek() > 0 && _partial == 0)
+    {
+        uint64_t ofs;
+
+        if (_seekable == 0 || (mpegd_index_time(_options->seek(), &ofs)
+            && mpeg_sync_time(fileno(_fp), _size, _options->seek(), &ofs, &_clock)))
+        {
+            fprintf(stderr, "can't seek to time (%.4f)\n", double(_options->seek()) / 90000.0);
+            return 1;
+        }
+
+        _clock_set = 1;
+
+        if (mpegd_seek(ofs))
+            return 1;
+    }
+
+    if (_options->window() && mpegd_window_start())
+        return 1;
+
+    // partial parses don't see the whole input in order
+    mpeg_table_t table;
+
+    if (_options->_table_name != NULL && _partial == 0)
+    {
+        if (table.open(_options->_table_name))
+        {
+            fprintf(stderr, "can't create packet table (%s)\n", _options->_table_name);
+            return 1;
+        }
+
+        _table = &table;
+    }
+
+    mpeg_index_t index;
+
+    if (_options->index() && _options->_par_mode == PAR_MODE_SCAN && whole)
+    {
+        if (mpegd_index_usable() == 0)
+        {
+            fprintf(stderr, "can't create index with packet checks\n");
+            return 1;
+        }
+
+        if (_options->_inp_name == NULL)
+        {
+            fprintf(stderr, "can't create index for standard input\n");
+            return 1;
+        }
+
+        if (index.create(_options->_inp_name, _fp))
+        {
+            fprintf(stderr, "can't create index (%s)\n", _options->_inp_name);
+            return 1;
+        }
+
+        _index = &index;
+    }
+    else if (index_units() != 0 && whole && _table == NULL && _options->_inp_name != NULL
+        && mpegd_index_usable() && index.open(_options->_inp_name, _fp) == 0)
+    {
+        // the replay seeks, so it doesn't use the input thread
+        return mpegd_parse_index(&index);
+    }
+
+    // the input thread reads ahead, so skipping can't seek
+    if (_options->threads() && _reader.start(_fp) == 0)
+    {
+        _reader_on = 1;
+        _seekable = 0;
+    }
+
+    int r = mpegd_parse();
+
+    if (_reader_on)
+    {
+        _reader_on = 0;
+        _reader.stop();
+    }
+
+    if (_index != NULL && r == 0 && _index->finish(_skip_cnt, _ofs))
+    {
+        fprintf(stderr, "can't write index (%s)\n", _options->_inp_name);
+        r = 1;
+    }
+
+    _table = NULL;
+    _index = NULL;
+    return r;
+}
+
+int mpeg_demux_t::mpegd_parse()
 {
     while (true)
     {
         if (mpegd_seek_header())
             return 0;
 
+        if (_ofs >= _range_end || _window_end)
+            return 0;
+
         switch (mpegd_get_bits(0, 32))
         {
         case MPEG_PACK_START:
@@ -1163,7 +2666,10 @@ int mpeg_demux_t::parse(mpeg_demux_t *mpeg)
             _end_cnt += 1;
             uint64_t ofs = _ofs + 4;
 
-            if (mpeg->end())
+            if (_index != NULL)
+                mpegd_index_add(MPEG_INDEX_END);
+
+            if (end())
                 return 1;
 
             if (mpegd_set_offset(this, ofs))
@@ -1191,7 +2697,12 @@ int MpegRemux::mpeg_remux_next_fp(mpeg_demux_t *mpeg)
 {
     //close current file
     if (_ext != NULL)
+    {
+        if (_clone.close())
+            return 1;
+
         fclose(_ext);
+    }
 
     char *fname = mpeg_get_name(_options->_demux_name, _sequence);
 
@@ -1199,9 +2710,18 @@ int MpegRemux::mpeg_remux_next_fp(mpeg_demux_t *mpeg)
         return 1;
 
     _sequence += 1;
-    _ext = fopen(fname, "wb");
+    _ext = mpeg_open_output(fname);
+    _shdr_done = 0;
     free(fname);
-    return _ext == NULL ? 1 : 0;
+
+    if (_ext != NULL)
+        _ext = mpeg_sum_open(_ext, &_sum_out, 1);
+
+    if (_ext == NULL)
+        return 1;
+
+    mpeg_remux_clone(_ext);
+    return 0;
 }
 
 int mpeg_demux_t::mpeg_buf_read(mpeg_buffer_t *buf, unsigned cnt)
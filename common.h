@@ -2,6 +2,12 @@
 #define COMMON_H
 
 #include "buffer.h"
+#include "clone.h"
+#include "crc.h"
+#include "index.h"
+#include "pipe.h"
+#include "sync.h"
+#include "table.h"
 
 class Options;
 
@@ -10,6 +16,7 @@ static constexpr uint16_t MPEG_END_CODE = 0x01b9;
 static constexpr uint16_t MPEG_PACK_START = 0x01ba;
 static constexpr uint16_t MPEG_SYSTEM_HEADER = 0x01bb;
 static constexpr uint16_t MPEG_PACKET_START = 0x0001;
+static constexpr uint64_t MPEG_WINDOW_LEAD = 90000;
 
 struct mpeg_stream_info_t
 {
@@ -51,6 +58,27 @@ class mpeg_demux_t
 private:
     void _resetStats();
     int _close = 0;
+    int _reader_on = 0;
+    mpeg_reader_t _reader;
+    mpeg_table_t *_table = nullptr;
+    void mpegd_table_add(uint8_t flags, uint32_t size);
+    mpeg_index_t *_index = nullptr;
+    void mpegd_index_add(uint8_t kind);
+    int mpegd_index_usable();
+    void mpegd_index_stats(const mpeg_index_entry_t *ent);
+    int mpegd_parse_index(mpeg_index_t *index);
+    int mpegd_parse_pack_header(mpeg_demux_t *mpeg);
+    mpeg_clock_t _clock;
+    int _clock_set = 0;
+    uint64_t _window_pack = 0;
+    uint64_t _window_time[512];
+    uint8_t _window_state[512];
+    unsigned _window_live = 0;
+    int _window_end = 0;
+    int mpegd_window_start();
+    int mpegd_index_time(uint64_t time, uint64_t *ofs);
+    void mpegd_window_pack();
+    int mpegd_parse();
     int mpegd_seek_header();
     int mpegd_parse_system_header();
     int _mpegd_buffer_fill(mpeg_demux_t *mpeg);
@@ -58,18 +86,36 @@ private:
     int mpegd_parse_packet1(mpeg_demux_t *mpeg, unsigned i);
     int mpegd_parse_packet2(mpeg_demux_t *mpeg, unsigned i);
 protected:
-    Options *_options;
+    uint64_t _range_start = 0;
+    uint64_t _range_end = UINT64_MAX;
+    int _partial = 0;
+    int _window = 0;
+    int _window_out = 0;
+    int mpeg_window_excl(unsigned sid, unsigned ssid);
+    const Options *_options;
     FILE *_fp2[512];
+    uint8_t _deselect[512];
+    mpeg_sum_t _sum[512];
+    mpeg_sum_t _sum_out;
+    int _summed = 0;
+    FILE *mpeg_sum_open(FILE *fp, mpeg_sum_t *sum, int close_fp);
     char *mpeg_get_name(const char *base, unsigned sid);
+    FILE *mpeg_open_output(const char *name);
     uint32_t mpegd_get_bits(unsigned i, unsigned n);
     int mpegd_skip(mpeg_demux_t *mpeg, unsigned n);
     int mpegd_set_offset(mpeg_demux_t *mpeg, uint64_t ofs);
+    int mpegd_seek(uint64_t ofs);
+    const uint8_t *_src = nullptr;
+    uint32_t _src_n = 0;
     int mpegd_parse_packet(mpeg_demux_t *mpeg);
+    size_t mpegd_fread(void *buf, size_t n);
     unsigned mpegd_read(mpeg_demux_t *mpeg, void *buf, unsigned n);
     int mpeg_buf_read(mpeg_buffer_t *buf, unsigned cnt);
     int mpeg_copy(mpeg_demux_t *mpeg, FILE *fp, unsigned n);
     int mpeg_stream_excl(uint8_t sid, uint8_t ssid);
     FILE *_fp;
+    int _seekable = 0;
+    uint64_t _size = 0;
     mpeg_buffer_t _packet_buf;
     mpeg_buffer_t _shdr_buf;
     mpeg_buffer_t _pack_buf;
@@ -99,7 +145,18 @@ public:
     virtual int skip();
     virtual int system_header();
     virtual int packet_check(mpeg_demux_t *mpeg);
-    mpeg_demux_t(FILE *fp, Options *options);
+    virtual unsigned index_units();
+    virtual int start(FILE *out);
+    virtual int finish(int r);
+    mpeg_demux_t(FILE *fp, const Options *options);
+    virtual ~mpeg_demux_t();
+    void range(uint64_t start, uint64_t end, int partial);
+    void mpeg_add_stats(const mpeg_demux_t *mpeg);
+    void feed(const mpeg_demux_t *mpeg, uint64_t ofs, const uint8_t *buf, unsigned n);
+    void feed_stats(const mpeg_demux_t *mpeg);
+    int save(FILE *fp);
+    int load(FILE *fp);
+    void unload();
     void mpeg_print_stats(mpeg_demux_t *mpeg, FILE *fp);
     void close();
 };
@@ -107,27 +164,52 @@ public:
 class MpegDemux : public mpeg_demux_t
 {
 private:
+    unsigned _spu_cnt = 0;
+    int _spu_half = 0;
     int mpeg_demux_copy_spu(mpeg_demux_t *mpeg, FILE *fp, unsigned cnt);
+    int mpeg_demux_frame(unsigned cnt);
+protected:
     FILE *mpeg_demux_open(mpeg_demux_t *mpeg, unsigned sid, unsigned ssid);
+    int mpeg_demux_write(FILE *fp, unsigned cnt);
 public:
-    MpegDemux(FILE *fp, Options *options);
+    MpegDemux(FILE *fp, const Options *options);
     int packet() override;
+    unsigned index_units() override;
+    int start(FILE *out) override;
+    int finish(int r) override;
     int demux(FILE *inp, FILE *out);
+    int demux_merge(MpegDemux **part, unsigned n, FILE *out);
 };
 
 class MpegRemux : public mpeg_demux_t
 {
 private:
     uint32_t _sequence = 0;
+    uint64_t _pack_ofs = 0;
+    mpeg_clone_t _clone;
+    mpeg_buffer_t _stage;
+    int _pack_staged = 0;
+    int _shdr_done = 0;
+    uint64_t _stage_scr = 0;
+    uint32_t _stage_mux = 0;
+    unsigned _stage_type = 0;
+    int mpeg_remux_compact_start();
+    int mpeg_remux_compact_flush(int have_next, uint64_t next_scr);
     int mpeg_remux_next_fp(mpeg_demux_t *mpeg);
+    int mpeg_remux_clone(FILE *out);
+    int mpeg_remux_put(mpeg_buffer_t *buf, uint64_t ofs);
 public:
-    MpegRemux(FILE *fp, Options *options);
+    MpegRemux(FILE *fp, const Options *options);
     int skip() override;
     int pack() override;
     int system_header() override;
     int packet() override;
     int end() override;
+    unsigned index_units() override;
+    int start(FILE *out) override;
+    int finish(int r) override;
     int remux(FILE *inp, FILE *out);
+    int remux_merge(MpegRemux **part, unsigned n, FILE *out);
 };
 
 class MpegScan : public mpeg_demux_t
@@ -136,23 +218,29 @@ private:
     uint64_t pts1[256];
     uint64_t pts2[256];
 public:
-    MpegScan(FILE *fp, Options *options);
+    MpegScan(FILE *fp, const Options *options);
     int packet() override;
     int end() override;
+    int start(FILE *out) override;
+    int finish(int r) override;
     int scan(FILE *inp, FILE *out);
+    int scan_merge(MpegScan **part, unsigned n, FILE *out);
 };
 
 class MpegList : public mpeg_demux_t
 {
 public:
-    MpegList(FILE *fp, Options *options);
+    MpegList(FILE *fp, const Options *options);
     void mpeg_list_print_skip(FILE *fp);
     int skip() override;
     int pack() override;
     int system_header() override;
     int packet() override;
     int end() override;
+    int start(FILE *out) override;
+    int finish(int r) override;
     int list(FILE *inp, FILE *out);
+    int list_merge(MpegList **part, unsigned n, FILE *out);
 };
 
 #endif
@@ -0,0 +1,217 @@
+#include "crc.h"
+#include <cstring>
+#include <mutex>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// CRC32C, the Castagnoli polynomial in reversed bit order
+static constexpr uint32_t MPEG_CRC32C_POLY = 0x82f63b78;
+
+static uint32_t crc_table[8][256];
+static uint32_t crc_x2n[32];
+static int crc_hw = 0;
+static std::once_flag crc_once;
+
+// a * b modulo the polynomial, bit 31 is x^0
+static uint32_t crc_mult(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+
+    while (true)
+    {
+        if (a & m)
+        {
+            p ^= b;
+
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ MPEG_CRC32C_POLY : b >> 1;
+    }
+
+    return p;
+}
+
+static void crc_init()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+
+        for (unsigned k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ MPEG_CRC32C_POLY : c >> 1;
+
+        crc_table[0][i] = c;
+    }
+
+    for (uint32_t i = 0; i < 256; i++)
+        for (unsigned k = 1; k < 8; k++)
+            crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xff];
+
+    // x^(2^k) for combining
+    crc_x2n[0] = 1u << 30;
+
+    for (unsigned k = 1; k < 32; k++)
+        crc_x2n[k] = crc_mult(crc_x2n[k - 1], crc_x2n[k - 1]);
+
+#if defined(__x86_64__)
+    crc_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const uint8_t *p, size_t n)
+{
+    uint64_t c = crc;
+
+    while (n > 0 && (uintptr_t(p) & 7) != 0)
+    {
+        c = _mm_crc32_u8(uint32_t(c), *p++);
+        n -= 1;
+    }
+
+    while (n >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        n -= 8;
+    }
+
+    while (n > 0)
+    {
+        c = _mm_crc32_u8(uint32_t(c), *p++);
+        n -= 1;
+    }
+
+    return uint32_t(c);
+}
+#endif
+
+// slicing by 8 for CPUs without the instruction
+static uint32_t crc_table8(uint32_t crc, const uint8_t *p, size_t n)
+{
+    while (n >= 8)
+    {
+        uint32_t lo = crc ^ (uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24);
+        uint32_t hi = uint32_t(p[4]) | uint32_t(p[5]) << 8 | uint32_t(p[6]) << 16 | uint32_t(p[7]) << 24;
+
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][lo >> 8 & 0xff] ^
+            crc_table[5][lo >> 16 & 0xff] ^ crc_table[4][lo >> 24] ^
+            crc_table[3][hi & 0xff] ^ crc_table[2][hi >> 8 & 0xff] ^
+            crc_table[1][hi >> 16 & 0xff] ^ crc_table[0][hi >> 24];
+
+        p += 8;
+        n -= 8;
+    }
+
+    while (n > 0)
+    {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+        n -= 1;
+    }
+
+    return crc;
+}
+
+// continue crc over buf, start with 0
+uint32_t mpeg_crc32c(uint32_t crc, const void *buf, size_t n)
+{
+    std::call_once(crc_once, crc_init);
+    const uint8_t *p = (const uint8_t *)buf;
+    crc = ~crc;
+
+#if defined(__x86_64__)
+    if (crc_hw)
+        return ~crc_sse42(crc, p, n);
+#endif
+
+    return ~crc_table8(crc, p, n);
+}
+
+// crc of the concatenation, given the crcs of both parts
+uint32_t mpeg_crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    std::call_once(crc_once, crc_init);
+    uint32_t p = 1u << 31;
+
+    // x^(8 * len2)
+    for (unsigned k = 3; len2 > 0; len2 >>= 1, k++)
+        if (len2 & 1)
+            p = crc_mult(crc_x2n[k & 31], p);
+
+    return crc_mult(p, crc1) ^ crc2;
+}
+
+void mpeg_sum_add(mpeg_sum_t *sum, const void *buf, size_t n)
+{
+    sum->crc = mpeg_crc32c(sum->crc, buf, n);
+    sum->len += n;
+}
+
+void mpeg_sum_cat(mpeg_sum_t *sum, const mpeg_sum_t *next)
+{
+    sum->crc = mpeg_crc32c_combine(sum->crc, next->crc, next->len);
+    sum->len += next->len;
+}
+
+FILE *mpeg_crc_t::open(FILE *fp, mpeg_sum_t *sum, int close_fp)
+{
+    mpeg_crc_t *c = new mpeg_crc_t;
+    c->_fp = fp;
+    c->_close_fp = close_fp;
+    c->_sum = sum;
+
+    cookie_io_functions_t io = { NULL, _write, NULL, _close };
+    FILE *ret = fopencookie(c, "wb", io);
+
+    if (ret == NULL)
+    {
+        delete c;
+        return NULL;
+    }
+
+    // hash in large blocks
+    setvbuf(ret, NULL, _IOFBF, 65536);
+    return ret;
+}
+
+ssize_t mpeg_crc_t::_write(void *cookie, const char *buf, size_t n)
+{
+    mpeg_crc_t *c = (mpeg_crc_t *)cookie;
+    size_t r = fwrite(buf, 1, n, c->_fp);
+    mpeg_sum_add(c->_sum, buf, r);
+
+    if (r != n)
+        return r > 0 ? ssize_t(r) : -1;
+
+    return ssize_t(n);
+}
+
+int mpeg_crc_t::_close(void *cookie)
+{
+    mpeg_crc_t *c = (mpeg_crc_t *)cookie;
+    int r = 0;
+
+    if (c->_close_fp)
+    {
+        if (fclose(c->_fp))
+            r = -1;
+    }
+    else if (fflush(c->_fp))
+    {
+        r = -1;
+    }
+
+    delete c;
+    return r;
+}
+
+
@@ -0,0 +1,37 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <inttypes.h>
+#include <cstdio>
+#include <sys/types.h>
+
+struct mpeg_sum_t
+{
+    uint32_t crc;
+    uint64_t len;
+};
+
+uint32_t mpeg_crc32c(uint32_t crc, const void *buf, size_t n);
+uint32_t mpeg_crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+void mpeg_sum_add(mpeg_sum_t *sum, const void *buf, size_t n);
+void mpeg_sum_cat(mpeg_sum_t *sum, const mpeg_sum_t *next);
+
+/*
+ * Output that checksums everything written through it into a
+ * mpeg_sum_t, so outputs never have to be read back for hashing.
+ */
+class mpeg_crc_t
+{
+private:
+    FILE *_fp = nullptr;
+    int _close_fp = 0;
+    mpeg_sum_t *_sum = nullptr;
+    static ssize_t _write(void *cookie, const char *buf, size_t n);
+    static int _close(void *cookie);
+public:
+    static FILE *open(FILE *fp, mpeg_sum_t *sum, int close_fp);
+};
+
+#endif
+
+
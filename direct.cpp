@@ -0,0 +1,135 @@
+#include "direct.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+FILE *mpeg_direct_t::open(const char *name)
+{
+    mpeg_direct_t *d = new mpeg_direct_t;
+    d->_fd = ::open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+
+    if (d->_fd < 0 && errno == EINVAL)
+    {
+        // file system does not support O_DIRECT, keep the staging
+        d->_fd = ::open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+
+    if (d->_fd < 0)
+    {
+        delete d;
+        return NULL;
+    }
+
+    void *buf;
+
+    if (posix_memalign(&buf, MPEG_DIRECT_ALIGN, MPEG_DIRECT_BUFFER))
+    {
+        ::close(d->_fd);
+        delete d;
+        return NULL;
+    }
+
+    d->_buf = (uint8_t *)buf;
+    cookie_io_functions_t io = { NULL, _write, NULL, _close };
+    FILE *fp = fopencookie(d, "wb", io);
+
+    if (fp == NULL)
+    {
+        _close(d);
+        return NULL;
+    }
+
+    // the staging buffer does the buffering
+    setvbuf(fp, NULL, _IONBF, 0);
+    return fp;
+}
+
+int mpeg_direct_t::_write_blocks(unsigned n)
+{
+    unsigned i = 0;
+
+    while (i < n)
+    {
+        ssize_t r = ::write(_fd, _buf + i, n - i);
+
+        if (r < 0 && errno == EINVAL)
+        {
+            // device rejected the alignment, fall back to buffered I/O
+            int flags = fcntl(_fd, F_GETFL);
+
+            if (flags < 0 || (flags & O_DIRECT) == 0)
+                return 1;
+
+            if (fcntl(_fd, F_SETFL, flags & ~O_DIRECT))
+                return 1;
+
+            continue;
+        }
+
+        if (r <= 0)
+            return 1;
+
+        i += unsigned(r);
+    }
+
+    return 0;
+}
+
+ssize_t mpeg_direct_t::_write(void *cookie, const char *buf, size_t n)
+{
+    mpeg_direct_t *d = (mpeg_direct_t *)cookie;
+    size_t ret = n;
+
+    while (n > 0)
+    {
+        uint32_t i = MPEG_DIRECT_BUFFER - d->_cnt;
+
+        if (i > n)
+            i = uint32_t(n);
+
+        memcpy(d->_buf + d->_cnt, buf, i);
+        d->_cnt += i;
+        d->_size += i;
+        buf += i;
+        n -= i;
+
+        if (d->_cnt == MPEG_DIRECT_BUFFER)
+        {
+            if (d->_write_blocks(MPEG_DIRECT_BUFFER))
+                return -1;
+
+            d->_cnt = 0;
+        }
+    }
+
+    return ssize_t(ret);
+}
+
+int mpeg_direct_t::_close(void *cookie)
+{
+    mpeg_direct_t *d = (mpeg_direct_t *)cookie;
+    int r = 0;
+
+    if (d->_cnt > 0)
+    {
+        // pad the tail to a whole block and cut it off afterwards
+        uint32_t n = (d->_cnt + MPEG_DIRECT_ALIGN - 1) & ~(MPEG_DIRECT_ALIGN - 1);
+        memset(d->_buf + d->_cnt, 0, n - d->_cnt);
+
+        if (d->_write_blocks(n))
+            r = -1;
+        else if (ftruncate(d->_fd, off_t(d->_size)))
+            r = -1;
+    }
+
+    if (d->_fd >= 0 && ::close(d->_fd))
+        r = -1;
+
+    ::free(d->_buf);
+    delete d;
+    return r;
+}
+
+
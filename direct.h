@@ -0,0 +1,32 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include <inttypes.h>
+#include <cstdio>
+#include <sys/types.h>
+
+static constexpr unsigned MPEG_DIRECT_ALIGN = 4096;
+static constexpr unsigned MPEG_DIRECT_BUFFER = 1024 * 1024;
+
+/*
+ * Output file written with O_DIRECT. Data is staged in an aligned
+ * buffer and written in whole blocks; the unaligned tail is padded
+ * on close and the file is truncated back to its real size.
+ */
+class mpeg_direct_t
+{
+private:
+    int _fd = -1;
+    uint8_t *_buf = nullptr;
+    uint32_t _cnt = 0;
+    uint64_t _size = 0;
+    int _write_blocks(unsigned n);
+    static ssize_t _write(void *cookie, const char *buf, size_t n);
+    static int _close(void *cookie);
+public:
+    static FILE *open(const char *name);
+};
+
+#endif
+
+
@@ -0,0 +1,222 @@
+#include "fan.h"
+#include "options.h"
+#include <cstdlib>
+#include <cstring>
+
+MpegFan::MpegFan(FILE *fp, const Options *options) : mpeg_demux_t(fp, options)
+{
+}
+
+MpegFan::~MpegFan()
+{
+    // child 0 runs on the main options and output
+    for (unsigned i = 0; i < _cnt; i++)
+    {
+        mpeg_fan_child_t *c = &_child[i];
+        delete c->mpeg;
+
+        if (i > 0)
+        {
+            if (c->opts->_par_out != NULL && c->opts->_par_out != stdout)
+                fclose(c->opts->_par_out);
+
+            delete c->opts;
+        }
+
+        free(c->argv);
+        free(c->line);
+    }
+
+    free(_child);
+}
+
+mpeg_demux_t *MpegFan::mpeg_fan_new(const Options *opts)
+{
+    if (opts->_par_mode == PAR_MODE_REMUX && opts->clone())
+        return NULL;
+
+    switch (opts->_par_mode)
+    {
+    case PAR_MODE_SCAN:
+        return new MpegScan(NULL, opts);
+    case PAR_MODE_LIST:
+        return new MpegList(NULL, opts);
+    case PAR_MODE_REMUX:
+        return new MpegRemux(NULL, opts);
+    case PAR_MODE_DEMUX:
+        return new MpegDemux(NULL, opts);
+    default:
+        return NULL;
+    }
+}
+
+// args are the child's options and output, the input is always ours
+int MpegFan::mpeg_fan_add(const char *args)
+{
+    mpeg_fan_child_t *c = &_child[_cnt];
+    memset(c, 0, sizeof(*c));
+    c->line = (char *)malloc(strlen(args) + 3);
+
+    if (c->line == NULL)
+        return 1;
+
+    sprintf(c->line, "- %s", args);
+    int argc;
+
+    if (Options::tokenize(c->line, "fan", &argc, &c->argv))
+        return 1;
+
+    c->opts = new Options();
+    _cnt += 1;
+
+    if (c->opts->parse(argc, c->argv))
+        return 1;
+
+    if (c->opts->_par_out == NULL || c->opts->_batch_name != NULL || c->opts->_fan_cnt > 0
+        || c->opts->window())
+    {
+        fprintf(stderr, "fan: bad arguments (%s)\n", args);
+        return 1;
+    }
+
+    c->mpeg = mpeg_fan_new(c->opts);
+
+    if (c->mpeg == NULL)
+    {
+        fprintf(stderr, "fan: mode not supported (%s)\n", args);
+        return 1;
+    }
+
+    return 0;
+}
+
+// hand one unit to every running child, a child stops at its first error
+int MpegFan::mpeg_fan_feed(const uint8_t *src, unsigned n, int (mpeg_demux_t::*fn)(), int stop)
+{
+    uint64_t ofs = _ofs;
+    unsigned live = 0;
+
+    for (unsigned i = 0; i < _cnt; i++)
+    {
+        mpeg_fan_child_t *c = &_child[i];
+
+        if (c->stop)
+            continue;
+
+        c->mpeg->feed(this, ofs, src, n);
+
+        if ((c->mpeg->*fn)() && stop)
+        {
+            c->stop = 1;
+            c->ret = stop > 0 ? 1 : 0;
+            continue;
+        }
+
+        live += 1;
+    }
+
+    return live > 0 ? 0 : 1;
+}
+
+// the unit is passed from our buffer if it is all there, else copied
+int MpegFan::mpeg_fan_unit(mpeg_buffer_t *tmp, unsigned n, int (mpeg_demux_t::*fn)(), int stop)
+{
+    if (n <= _buf_n)
+    {
+        int r = mpeg_fan_feed(this->buf + _buf_i, n, fn, stop);
+        mpegd_skip(this, n);
+        return r;
+    }
+
+    uint64_t ofs = _ofs;
+    mpeg_buf_read(tmp, n);
+    uint64_t end = _ofs;
+    _ofs = ofs;
+    int r = mpeg_fan_feed(tmp->buf, tmp->cnt, fn, stop);
+    _ofs = end;
+    return r;
+}
+
+int MpegFan::pack()
+{
+    return mpeg_fan_unit(&_pack_buf, _pack.size, &mpeg_demux_t::pack, 1);
+}
+
+// errors in packet handlers don't stop a parse, so they don't stop a child
+int MpegFan::packet()
+{
+    mpeg_fan_unit(&_packet_buf, _packet.size, &mpeg_demux_t::packet, 0);
+    return 0;
+}
+
+int MpegFan::system_header()
+{
+    return mpeg_fan_unit(&_shdr_buf, _shdr.size, &mpeg_demux_t::system_header, 1);
+}
+
+// skips and end codes are consumed by the parser, the children only peek
+int MpegFan::skip()
+{
+    unsigned n = _buf_n < 1 ? _buf_n : 1;
+    return mpeg_fan_feed(this->buf + _buf_i, n, &mpeg_demux_t::skip, -1);
+}
+
+int MpegFan::end()
+{
+    unsigned n = _buf_n < 4 ? _buf_n : 4;
+    return mpeg_fan_feed(this->buf + _buf_i, n, &mpeg_demux_t::end, 1);
+}
+
+int MpegFan::fan(FILE *inp, FILE *out)
+{
+    const Options *opts = _options;
+    _child = (mpeg_fan_child_t *)malloc((opts->_fan_cnt + 1) * sizeof(mpeg_fan_child_t));
+
+    if (_child == NULL)
+        return 1;
+
+    mpeg_fan_child_t *c = &_child[_cnt];
+    memset(c, 0, sizeof(*c));
+    c->opts = (Options *)opts;
+    c->mpeg = mpeg_fan_new(opts);
+
+    if (c->mpeg == NULL)
+    {
+        fprintf(stderr, "fan: mode not supported\n");
+        return 1;
+    }
+
+    _cnt += 1;
+
+    for (unsigned i = 0; i < opts->_fan_cnt; i++)
+        if (mpeg_fan_add(opts->_fan[i]))
+            return 1;
+
+    for (unsigned i = 0; i < _cnt; i++)
+    {
+        if (_child[i].mpeg->start(i > 0 ? _child[i].opts->_par_out : out) == 0)
+            continue;
+
+        while (i-- > 0)
+            _child[i].mpeg->finish(1);
+
+        return 1;
+    }
+
+    int r = parse(this);
+    int ret = 0;
+
+    for (unsigned i = 0; i < _cnt; i++)
+    {
+        c = &_child[i];
+        c->mpeg->feed_stats(this);
+
+        if (c->mpeg->finish(c->stop ? c->ret : r))
+            ret = 1;
+    }
+
+    close();
+    return ret;
+}
+
+
@@ -0,0 +1,43 @@
+#ifndef FAN_H
+#define FAN_H
+
+#include "common.h"
+
+struct mpeg_fan_child_t
+{
+    Options *opts;
+    char *line;
+    char **argv;
+    mpeg_demux_t *mpeg;
+    int stop;
+    int ret;
+};
+
+/*
+ * Runs several modes on a single read of the input. The driver parses
+ * the stream once and hands every unit to each mode's handlers, which
+ * read it from memory instead of from the file.
+ */
+class MpegFan : public mpeg_demux_t
+{
+private:
+    mpeg_fan_child_t *_child = nullptr;
+    unsigned _cnt = 0;
+    static mpeg_demux_t *mpeg_fan_new(const Options *opts);
+    int mpeg_fan_add(const char *args);
+    int mpeg_fan_feed(const uint8_t *src, unsigned n, int (mpeg_demux_t::*fn)(), int stop);
+    int mpeg_fan_unit(mpeg_buffer_t *tmp, unsigned n, int (mpeg_demux_t::*fn)(), int stop);
+public:
+    MpegFan(FILE *fp, const Options *options);
+    ~MpegFan();
+    int pack() override;
+    int packet() override;
+    int system_header() override;
+    int skip() override;
+    int end() override;
+    int fan(FILE *inp, FILE *out);
+};
+
+#endif
+
+
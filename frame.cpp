@@ -0,0 +1,129 @@
+#include "frame.h"
+#include "options.h"
+#include <cstring>
+
+static void mpeg_frame_put64(uint8_t *buf, uint64_t val)
+{
+    for (unsigned i = 0; i < 8; i++)
+    {
+        buf[7 - i] = val & 0xff;
+        val = val >> 8;
+    }
+}
+
+static uint64_t mpeg_frame_get64(const uint8_t *buf)
+{
+    uint64_t val = 0;
+
+    for (unsigned i = 0; i < 8; i++)
+        val = (val << 8) | buf[i];
+
+    return val;
+}
+
+void mpeg_frame_set(uint8_t *buf, const mpeg_packet_t *packet, uint32_t size)
+{
+    buf[0] = packet->sid;
+    buf[1] = packet->sid == 0xbd ? packet->ssid : 0;
+    buf[2] = (packet->have_pts ? 1 : 0) | (packet->have_dts ? 2 : 0);
+    buf[3] = 0;
+    mpeg_frame_put64(buf + 4, packet->pts);
+    mpeg_frame_put64(buf + 12, packet->dts);
+    buf[20] = (size >> 24) & 0xff;
+    buf[21] = (size >> 16) & 0xff;
+    buf[22] = (size >> 8) & 0xff;
+    buf[23] = size & 0xff;
+}
+
+void mpeg_frame_get(const uint8_t *buf, mpeg_packet_t *packet)
+{
+    packet->type = 0;
+    packet->sid = buf[0];
+    packet->ssid = buf[1];
+    packet->have_pts = buf[2] & 1;
+    packet->have_dts = (buf[2] >> 1) & 1;
+    packet->pts = mpeg_frame_get64(buf + 4);
+    packet->dts = mpeg_frame_get64(buf + 12);
+    packet->size = (uint32_t(buf[20]) << 24) | (uint32_t(buf[21]) << 16)
+        | (uint32_t(buf[22]) << 8) | buf[23];
+    packet->offset = 0;
+}
+
+MpegUnframe::MpegUnframe(FILE *fp, const Options *options) : MpegDemux(fp, options)
+{
+}
+
+int MpegUnframe::unframe(FILE *inp, FILE *out)
+{
+    uint8_t hdr[MPEG_FRAME_HEADER];
+
+    for (unsigned i = 0; i < 512; i++)
+        _fp2[i] = NULL;
+
+    _ext = out;
+
+    if (mpegd_read(this, hdr, MPEG_FRAME_START) != MPEG_FRAME_START
+        || memcmp(hdr, MPEG_FRAME_MAGIC, MPEG_FRAME_START) != 0)
+    {
+        fprintf(stderr, "unframe: not a framed stream\n");
+        return 1;
+    }
+
+    int r = 0;
+    unsigned n;
+
+    while ((n = mpegd_read(this, hdr, MPEG_FRAME_HEADER)) == MPEG_FRAME_HEADER)
+    {
+        mpeg_frame_get(hdr, &_packet);
+        uint32_t sid = _packet.sid;
+        uint32_t ssid = _packet.ssid;
+        _packet_cnt += 1;
+        streams[sid].packet_cnt += 1;
+        streams[sid].size += _packet.size;
+
+        if (sid == 0xbd)
+        {
+            substreams[ssid].packet_cnt += 1;
+            substreams[ssid].size += _packet.size;
+        }
+
+        if (mpeg_stream_excl(sid, ssid))
+        {
+            if (mpegd_skip(this, _packet.size))
+                break;
+
+            continue;
+        }
+
+        uint32_t fpi = sid == 0xbd ? 256 + ssid : sid;
+
+        if (_fp2[fpi] == NULL)
+        {
+            _fp2[fpi] = mpeg_demux_open(this, sid, ssid);
+
+            if (_fp2[fpi] == NULL)
+            {
+                mpegd_skip(this, _packet.size);
+                continue;
+            }
+        }
+
+        mpeg_demux_write(_fp2[fpi], _packet.size);
+    }
+
+    if (n != 0)
+    {
+        fprintf(stderr, "unframe: incomplete frame\n");
+        r = 1;
+    }
+
+    close();
+
+    for (unsigned i = 0; i < 512; i++)
+        if (_fp2[i] != NULL && _fp2[i] != out)
+            fclose(_fp2[i]);
+
+    return r;
+}
+
+
@@ -0,0 +1,28 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "common.h"
+
+/*
+ * Framed output: an 8 byte file header followed by one frame per
+ * packet. A frame is sid, ssid, flags (1 = pts, 2 = dts), a reserved
+ * byte, the 64 bit pts and dts and the 32 bit payload size, all big
+ * endian, followed by the payload.
+ */
+static constexpr char MPEG_FRAME_MAGIC[] = "MPDF\x01\0\0";
+static constexpr unsigned MPEG_FRAME_START = 8;
+static constexpr unsigned MPEG_FRAME_HEADER = 24;
+
+void mpeg_frame_set(uint8_t *buf, const mpeg_packet_t *packet, uint32_t size);
+void mpeg_frame_get(const uint8_t *buf, mpeg_packet_t *packet);
+
+class MpegUnframe : public MpegDemux
+{
+public:
+    MpegUnframe(FILE *fp, const Options *options);
+    int unframe(FILE *inp, FILE *out);
+};
+
+#endif
+
+
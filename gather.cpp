@@ -0,0 +1,205 @@
+#include "gather.h"
+#include "options.h"
+#include "clone.h"
+#include "pool.h"
+#include <unistd.h>
+
+MpegGather::MpegGather(FILE *fp, const Options *options) : MpegDemux(fp, options)
+{
+}
+
+MpegGather::~MpegGather()
+{
+    for (unsigned i = 0; i < 512; i++)
+        _span[i].free();
+}
+
+// add a payload range, ranges that touch are joined
+int MpegGather::mpeg_gather_span(unsigned fpi, uint64_t ofs, uint64_t len)
+{
+    mpeg_buffer_t *buf = &_span[fpi];
+
+    if (len == 0)
+        return 0;
+
+    if (buf->cnt >= sizeof(mpeg_span_t))
+    {
+        mpeg_span_t *last = (mpeg_span_t *)(buf->buf + buf->cnt - sizeof(mpeg_span_t));
+
+        if (last->ofs + last->len == ofs)
+        {
+            last->len += len;
+            return 0;
+        }
+    }
+
+    mpeg_span_t span = { ofs, len };
+    return buf->append(&span, sizeof(span));
+}
+
+int MpegGather::packet()
+{
+    if (_gather == 0)
+        return MpegDemux::packet();
+
+    uint32_t sid = _packet.sid;
+    uint32_t ssid = _packet.ssid;
+
+    if (mpeg_stream_excl(sid, ssid) || mpeg_window_excl(sid, ssid))
+        return 0;
+
+    uint32_t cnt = _packet.offset;
+    uint32_t fpi = sid;
+
+    if (sid == 0xbd)
+    {
+        fpi = 256 + ssid;
+        cnt += 1;
+
+        if (_options->dvdac3())
+            cnt += 3;
+    }
+
+    if (cnt > _packet.size)
+    {
+        fprintf(stderr, "demux: AC3 packet too small (sid=%02x size=%u)\n",
+            sid, _packet.size);
+
+        return 1;
+    }
+
+    if (_fp2[fpi] == NULL)
+    {
+        _fp2[fpi] = mpeg_demux_open(this, sid, ssid);
+
+        if (_fp2[fpi] == NULL)
+            return 1;
+    }
+
+    // the payload is not read here, only its position is kept
+    uint64_t ofs = _ofs + cnt;
+    uint32_t len = _packet.size - cnt;
+    uint32_t have = ofs >= _size ? 0 : _size - ofs < len ? uint32_t(_size - ofs) : len;
+
+    if (have < len)
+    {
+        fprintf(stderr, "demux: incomplete packet (sid=%02x size=%u/%u)\n",
+            sid, have, len);
+
+        // a demux would have read up to the end of the input
+        if (_options->drop() == 0)
+            mpeg_gather_span(fpi, ofs, have);
+
+        mpegd_set_offset(this, ofs + have);
+        return 1;
+    }
+
+    return mpeg_gather_span(fpi, ofs, len);
+}
+
+int MpegGather::mpeg_gather_copy(unsigned fpi)
+{
+    FILE *fp = _fp2[fpi];
+    const mpeg_span_t *span = (const mpeg_span_t *)_span[fpi].buf;
+    unsigned n = _span[fpi].cnt / sizeof(mpeg_span_t);
+    mpeg_clone_t clone;
+    int r = 0;
+
+    if (clone.open(_fp, fp) == 0)
+    {
+        for (unsigned i = 0; i < n; i++)
+            if (clone.copy(span[i].ofs, span[i].len))
+                r = 1;
+
+        if (clone.close())
+            r = 1;
+
+        return r;
+    }
+
+    // wrapped outputs (O_DIRECT, writer thread) only take fwrite
+    uint8_t buf[65536];
+
+    for (unsigned i = 0; i < n && r == 0; i++)
+    {
+        uint64_t ofs = span[i].ofs;
+        uint64_t len = span[i].len;
+
+        while (len > 0)
+        {
+            size_t k = len < sizeof(buf) ? size_t(len) : sizeof(buf);
+            ssize_t j = pread(_fd, buf, k, off_t(ofs));
+
+            if (j <= 0 || fwrite(buf, 1, size_t(j), fp) != size_t(j))
+            {
+                r = 1;
+                break;
+            }
+
+            ofs += uint64_t(j);
+            len -= uint64_t(j);
+        }
+    }
+
+    return r;
+}
+
+void MpegGather::mpeg_gather_worker(void *ctx, unsigned i)
+{
+    MpegGather *mpeg = (MpegGather *)ctx;
+    unsigned fpi = mpeg->_list[i];
+    mpeg->_ret[fpi] = mpeg->mpeg_gather_copy(fpi);
+}
+
+int MpegGather::gather(FILE *inp, FILE *out)
+{
+    // streams into one output or transformed payloads need the order
+    if (_seekable == 0 || _options->_demux_name == NULL || _options->dvdsub()
+        || _options->framed() || _options->threads() || _options->checksum())
+    {
+        return demux(inp, out);
+    }
+
+    for (unsigned i = 0; i < 512; i++)
+    {
+        _fp2[i] = NULL;
+        _ret[i] = 0;
+        _span[i].init();
+    }
+
+    _ext = out;
+    _fd = fileno(_fp);
+    _gather = 1;
+    int r = parse(this);
+
+    unsigned cnt = 0;
+
+    for (unsigned i = 0; i < 512; i++)
+        if (_fp2[i] != NULL && _span[i].cnt > 0)
+            _list[cnt++] = i;
+
+    mpeg_pool_t pool;
+    pool.run(cnt, _options->jobs(), mpeg_gather_worker, this);
+
+    for (unsigned i = 0; i < 512; i++)
+    {
+        if (_ret[i])
+        {
+            fprintf(stderr, "demux: can't write stream (sid=%02x ssid=%02x)\n",
+                i < 256 ? i : 0xbd, i < 256 ? 0 : i - 256);
+
+            r = 1;
+        }
+
+        if (_fp2[i] != NULL && _fp2[i] != out)
+            if (fclose(_fp2[i]))
+                r = 1;
+
+        _fp2[i] = NULL;
+    }
+
+    close();
+    return r;
+}
+
+
@@ -0,0 +1,37 @@
+#ifndef GATHER_H
+#define GATHER_H
+
+#include "common.h"
+
+struct mpeg_span_t
+{
+    uint64_t ofs;
+    uint64_t len;
+};
+
+/*
+ * Two pass demux. The first pass only parses headers and collects the
+ * payload ranges of every stream, the second pass assembles each
+ * stream file on its own thread with copy offload or pread.
+ */
+class MpegGather : public MpegDemux
+{
+private:
+    mpeg_buffer_t _span[512];
+    unsigned _list[512];
+    int _ret[512];
+    int _fd = -1;
+    int _gather = 0;
+    int mpeg_gather_span(unsigned fpi, uint64_t ofs, uint64_t len);
+    int mpeg_gather_copy(unsigned fpi);
+    static void mpeg_gather_worker(void *ctx, unsigned i);
+public:
+    MpegGather(FILE *fp, const Options *options);
+    ~MpegGather();
+    int packet() override;
+    int gather(FILE *inp, FILE *out);
+};
+
+#endif
+
+
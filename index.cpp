@@ -0,0 +1,480 @@
+#include "index.h"
+#include "sync.h"
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static uint64_t mpeg_zigzag(uint64_t val)
+{
+    return (val << 1) ^ uint64_t(int64_t(val) >> 63);
+}
+
+static uint64_t mpeg_unzigzag(uint64_t val)
+{
+    return (val >> 1) ^ (0 - (val & 1));
+}
+
+// header size of a pack of this type
+static uint32_t mpeg_index_pack_size(uint8_t type, uint8_t stuff)
+{
+    if (type == 1)
+        return 12;
+
+    if (type == 2)
+        return 14 + stuff;
+
+    return 4;
+}
+
+// 1 if the payload starts a sequence or a group of pictures
+int mpeg_index_key(const uint8_t *buf, unsigned n)
+{
+    unsigned i = 0;
+
+    while ((i += mpeg_find_start(buf + i, n - i)) + 3 < n)
+    {
+        if (buf[i + 3] == 0xb3 || buf[i + 3] == 0xb8)
+            return 1;
+
+        i += 3;
+    }
+
+    return 0;
+}
+
+mpeg_index_t::~mpeg_index_t()
+{
+    close();
+}
+
+char *mpeg_index_t::name(const char *inp)
+{
+    size_t n = strlen(inp) + 5;
+    char *ret = (char *)malloc(n);
+
+    if (ret != NULL)
+        snprintf(ret, n, "%s.idx", inp);
+
+    return ret;
+}
+
+void mpeg_index_t::_reset()
+{
+    _end = 0;
+    _scr = 0;
+    _mux = 0;
+    _skip = 0;
+    _buf_i = 0;
+    _buf_n = 0;
+
+    for (unsigned i = 0; i < 512; i++)
+        _pts[i] = 0;
+}
+
+// an index belongs to one version of a regular file
+int mpeg_index_t::_stat(FILE *inp, uint64_t *size, uint64_t *mtime)
+{
+    struct stat st;
+
+    if (fstat(fileno(inp), &st) || !S_ISREG(st.st_mode))
+        return 1;
+
+    *size = uint64_t(st.st_size);
+    *mtime = uint64_t(st.st_mtim.tv_sec) * 1000000000 + uint64_t(st.st_mtim.tv_nsec);
+    return 0;
+}
+
+// records are collected in the buffer and written in blocks
+void mpeg_index_t::_putc(unsigned c)
+{
+    _buf[_buf_n++] = uint8_t(c);
+}
+
+void mpeg_index_t::_put(uint64_t val)
+{
+    while (val >= 0x80)
+    {
+        _putc(unsigned(val & 0x7f) | 0x80);
+        val >>= 7;
+    }
+
+    _putc(unsigned(val));
+}
+
+int mpeg_index_t::_flush()
+{
+    unsigned n = _buf_n;
+    _buf_n = 0;
+    return fwrite(_buf, 1, n, _fp) != n;
+}
+
+int mpeg_index_t::_getc()
+{
+    if (_buf_i >= _buf_n)
+    {
+        _buf_i = 0;
+        _buf_n = unsigned(fread(_buf, 1, sizeof(_buf), _fp));
+
+        if (_buf_n == 0)
+            return EOF;
+    }
+
+    return _buf[_buf_i++];
+}
+
+int mpeg_index_t::_get(uint64_t *val)
+{
+    *val = 0;
+
+    for (unsigned i = 0; i < 64; i += 7)
+    {
+        int c = _getc();
+
+        if (c == EOF)
+            return 1;
+
+        *val |= uint64_t(c & 0x7f) << i;
+
+        if ((c & 0x80) == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+// magic, version, input size and mtime, length of the units, little endian
+int mpeg_index_t::create(const char *inp, FILE *fp)
+{
+    uint8_t buf[MPEG_INDEX_HEADER];
+    uint64_t val[5] = { MPEG_INDEX_VERSION, 0, 0, 0, 0 };
+    unsigned size[5] = { 4, 4, 8, 8, 8 };
+    unsigned n = sizeof(MPEG_INDEX_MAGIC);
+
+    if (_stat(fp, &val[2], &val[3]))
+        return 1;
+
+    _name = name(inp);
+
+    if (_name == NULL)
+        return 1;
+
+    // written next to the index and renamed once it is complete
+    _tmp = (char *)malloc(strlen(_name) + 5);
+
+    if (_tmp == NULL)
+        return 1;
+
+    sprintf(_tmp, "%s.tmp", _name);
+    _fp = fopen(_tmp, "wb");
+
+    if (_fp == NULL)
+        return 1;
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, MPEG_INDEX_MAGIC, n);
+
+    for (unsigned i = 0; i < 5; i++)
+        for (unsigned j = 0; j < size[i]; j++)
+            buf[n++] = uint8_t(val[i] >> (8 * j));
+
+    _reset();
+    return fwrite(buf, 1, sizeof(buf), _fp) != sizeof(buf);
+}
+
+// 1 if there is no index or it is for another version of the input
+int mpeg_index_t::open(const char *inp, FILE *fp)
+{
+    uint8_t buf[MPEG_INDEX_HEADER];
+    uint64_t val[5] = { 0, 0, 0, 0, 0 };
+    unsigned size[5] = { 4, 4, 8, 8, 8 };
+    unsigned n = sizeof(MPEG_INDEX_MAGIC);
+    uint64_t inp_size, inp_mtime;
+    struct stat st;
+
+    if (_stat(fp, &inp_size, &inp_mtime))
+        return 1;
+
+    _name = name(inp);
+
+    if (_name == NULL)
+        return 1;
+
+    _fp = fopen(_name, "rb");
+
+    if (_fp == NULL)
+        return 1;
+
+    if (fread(buf, 1, sizeof(buf), _fp) != sizeof(buf) || memcmp(buf, MPEG_INDEX_MAGIC, n) != 0)
+    {
+        close();
+        return 1;
+    }
+
+    for (unsigned i = 0; i < 5; i++)
+        for (unsigned j = 0; j < size[i]; j++)
+            val[i] |= uint64_t(buf[n++]) << (8 * j);
+
+    if (val[0] != MPEG_INDEX_VERSION || val[2] != inp_size || val[3] != inp_mtime
+        || fstat(fileno(_fp), &st) || uint64_t(st.st_size) != MPEG_INDEX_HEADER + val[4])
+    {
+        close();
+        return 1;
+    }
+
+    _reset();
+    return 0;
+}
+
+int mpeg_index_t::add(const mpeg_index_entry_t *ent)
+{
+    uint8_t flags = 0;
+    uint32_t size = 4;
+
+    // units never overlap, else the parse had an error
+    if (_fp == NULL || ent->ofs < _end)
+        return 1;
+
+    if (_buf_n + MPEG_INDEX_RECORD > sizeof(_buf) && _flush())
+        return 1;
+
+    if (ent->kind == MPEG_INDEX_PACK)
+        flags = ent->type;
+    else if (ent->kind == MPEG_INDEX_SHDR)
+        flags = ent->fixed | ent->csps << 1;
+    else if (ent->kind == MPEG_INDEX_PACKET)
+        flags = ent->flags;
+
+    _putc(ent->kind | flags << 4 | (ent->skip != _skip ? 0x08 : 0));
+
+    if (ent->skip != _skip)
+        _put(ent->skip - _skip);
+
+    _skip = ent->skip;
+    _put(ent->ofs - _end);
+
+    switch (ent->kind)
+    {
+    case MPEG_INDEX_PACK:
+        _put(mpeg_zigzag(ent->scr - _scr));
+        _put(mpeg_zigzag(uint64_t(ent->mux_rate) - _mux) << 3 | ent->stuff);
+        _scr = ent->scr;
+        _mux = ent->mux_rate;
+        size = mpeg_index_pack_size(ent->type, ent->stuff);
+        break;
+    case MPEG_INDEX_SHDR:
+        _put(ent->size);
+        size = ent->size;
+        break;
+    case MPEG_INDEX_PACKET:
+    {
+        unsigned key = ent->sid == 0xbd ? 256 + ent->ssid : ent->sid;
+        _putc(ent->sid);
+
+        if (ent->sid == 0xbd)
+            _putc(ent->ssid);
+
+        _put(ent->size);
+        _put(uint64_t(ent->offset) << 2 | ent->type);
+
+        if (ent->flags & MPEG_INDEX_PTS)
+        {
+            _put(mpeg_zigzag(ent->pts - _pts[key]));
+            _pts[key] = ent->pts;
+        }
+
+        if (ent->flags & MPEG_INDEX_DTS)
+            _put(mpeg_zigzag(ent->pts - ent->dts));
+
+        size = ent->size;
+    }
+        break;
+    default:
+        break;
+    }
+
+    _end = ent->ofs + size;
+    return 0;
+}
+
+// 1 at the stop record, -1 on a damaged index
+int mpeg_index_t::next(mpeg_index_entry_t *ent)
+{
+    uint64_t val;
+    int tag = _getc();
+
+    if (tag == EOF)
+        return -1;
+
+    memset(ent, 0, sizeof(*ent));
+    ent->kind = uint8_t(tag & 0x07);
+
+    if (tag & 0x08)
+    {
+        if (_get(&val))
+            return -1;
+
+        _skip += uint32_t(val);
+    }
+
+    ent->skip = _skip;
+
+    if (_get(&val))
+        return -1;
+
+    ent->ofs = _end + val;
+
+    switch (ent->kind)
+    {
+    case MPEG_INDEX_PACK:
+        ent->type = uint8_t(tag >> 4);
+
+        if (_get(&val))
+            return -1;
+
+        _scr += mpeg_unzigzag(val);
+
+        if (_get(&val))
+            return -1;
+
+        _mux += uint32_t(mpeg_unzigzag(val >> 3));
+        ent->stuff = uint8_t(val & 7);
+        ent->scr = _scr;
+        ent->mux_rate = _mux;
+        ent->size = mpeg_index_pack_size(ent->type, ent->stuff);
+        break;
+    case MPEG_INDEX_SHDR:
+        ent->fixed = uint8_t((tag >> 4) & 1);
+        ent->csps = uint8_t((tag >> 5) & 1);
+
+        if (_get(&val))
+            return -1;
+
+        ent->size = uint32_t(val);
+        break;
+    case MPEG_INDEX_PACKET:
+    {
+        int c = _getc();
+        ent->flags = uint8_t(tag >> 4);
+
+        if (c == EOF)
+            return -1;
+
+        ent->sid = uint8_t(c);
+
+        if (ent->sid == 0xbd)
+        {
+            if ((c = _getc()) == EOF)
+                return -1;
+
+            ent->ssid = uint8_t(c);
+        }
+
+        unsigned key = ent->sid == 0xbd ? 256 + ent->ssid : ent->sid;
+
+        if (_get(&val))
+            return -1;
+
+        ent->size = uint32_t(val);
+
+        if (_get(&val))
+            return -1;
+
+        ent->offset = uint32_t(val >> 2);
+        ent->type = uint8_t(val & 3);
+
+        if (ent->flags & MPEG_INDEX_PTS)
+        {
+            if (_get(&val))
+                return -1;
+
+            _pts[key] += mpeg_unzigzag(val);
+            ent->pts = _pts[key];
+        }
+
+        if (ent->flags & MPEG_INDEX_DTS)
+        {
+            if (_get(&val))
+                return -1;
+
+            ent->dts = ent->pts - mpeg_unzigzag(val);
+        }
+    }
+        break;
+    case MPEG_INDEX_END:
+        ent->size = 4;
+        break;
+    case MPEG_INDEX_STOP:
+        return 1;
+    default:
+        return -1;
+    }
+
+    _end = ent->ofs + ent->size;
+    return 0;
+}
+
+// write the stop record and the length, then move the index in place
+int mpeg_index_t::finish(uint32_t skip, uint64_t ofs)
+{
+    uint8_t buf[8];
+    int r = _fp == NULL || _flush();
+
+    if (r == 0)
+    {
+        _putc(MPEG_INDEX_STOP | (skip != _skip ? 0x08 : 0));
+
+        if (skip != _skip)
+            _put(skip - _skip);
+
+        _put(ofs > _end ? ofs - _end : 0);
+        r = _flush();
+    }
+
+    off_t n = r == 0 && fflush(_fp) == 0 ? ftello(_fp) : -1;
+
+    if (n < MPEG_INDEX_HEADER)
+        r = 1;
+
+    for (unsigned i = 0; i < 8 && r == 0; i++)
+        buf[i] = uint8_t(uint64_t(n - MPEG_INDEX_HEADER) >> (8 * i));
+
+    if (r == 0)
+        r = fseeko(_fp, MPEG_INDEX_HEADER - 8, SEEK_SET) || fwrite(buf, 1, 8, _fp) != 8;
+
+    if (_fp != NULL && fclose(_fp))
+        r = 1;
+
+    _fp = NULL;
+
+    if (r == 0 && rename(_tmp, _name))
+        r = 1;
+
+    if (r == 0)
+    {
+        free(_tmp);
+        _tmp = NULL;
+    }
+
+    close();
+    return r;
+}
+
+// an unfinished index is removed
+void mpeg_index_t::close()
+{
+    if (_fp != NULL)
+        fclose(_fp);
+
+    _fp = NULL;
+
+    if (_tmp != NULL)
+        unlink(_tmp);
+
+    free(_tmp);
+    free(_name);
+    _tmp = NULL;
+    _name = NULL;
+}
+
+
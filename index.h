@@ -0,0 +1,85 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <inttypes.h>
+#include <cstdio>
+
+static constexpr char MPEG_INDEX_MAGIC[8] = { 'M', 'P', 'G', 'I', 'N', 'D', 'X', 0 };
+static constexpr uint32_t MPEG_INDEX_VERSION = 1;
+static constexpr unsigned MPEG_INDEX_HEADER = 40;
+static constexpr unsigned MPEG_INDEX_RECORD = 64;
+static constexpr uint8_t MPEG_INDEX_PACK = 0;
+static constexpr uint8_t MPEG_INDEX_SHDR = 1;
+static constexpr uint8_t MPEG_INDEX_PACKET = 2;
+static constexpr uint8_t MPEG_INDEX_END = 3;
+static constexpr uint8_t MPEG_INDEX_STOP = 4;
+static constexpr uint8_t MPEG_INDEX_PTS = 0x01;
+static constexpr uint8_t MPEG_INDEX_DTS = 0x02;
+static constexpr uint8_t MPEG_INDEX_KEY = 0x04;
+
+// one unit of the parse, skip is the skipped byte count before it
+struct mpeg_index_entry_t
+{
+    uint8_t kind;
+    uint8_t flags;
+    uint8_t type;
+    uint8_t sid;
+    uint8_t ssid;
+    uint8_t stuff;
+    uint8_t fixed;
+    uint8_t csps;
+    uint64_t ofs;
+    uint32_t size;
+    uint32_t offset;
+    uint32_t skip;
+    uint32_t mux_rate;
+    uint64_t scr;
+    uint64_t pts;
+    uint64_t dts;
+};
+
+/*
+ * Sidecar index next to the input, written by a scan and replayed by
+ * the other modes. After a 40 byte header with the input's size and
+ * modification time come the units in input order. Every unit is a
+ * tag byte and varints: offsets are gaps to the end of the previous
+ * unit, SCR, mux rate and PTS are deltas to the previous pack or to
+ * the previous packet of the same stream. A stop record ends the list.
+ */
+class mpeg_index_t
+{
+private:
+    FILE *_fp = nullptr;
+    char *_name = nullptr;
+    char *_tmp = nullptr;
+    uint64_t _end = 0;
+    uint64_t _scr = 0;
+    uint32_t _mux = 0;
+    uint32_t _skip = 0;
+    uint64_t _pts[512];
+    uint8_t _buf[4096];
+    unsigned _buf_i = 0;
+    unsigned _buf_n = 0;
+    void _putc(unsigned c);
+    void _put(uint64_t val);
+    int _flush();
+    int _getc();
+    int _get(uint64_t *val);
+    int _stat(FILE *inp, uint64_t *size, uint64_t *mtime);
+    void _reset();
+public:
+    ~mpeg_index_t();
+    static char *name(const char *inp);
+    int create(const char *inp, FILE *fp);
+    int open(const char *inp, FILE *fp);
+    int add(const mpeg_index_entry_t *ent);
+    int next(mpeg_index_entry_t *ent);
+    int finish(uint32_t skip, uint64_t ofs);
+    void close();
+};
+
+int mpeg_index_key(const uint8_t *buf, unsigned n);
+
+#endif
+
+
@@ -0,0 +1,124 @@
+#include "job.h"
+#include "common.h"
+#include "rewrite.h"
+#include "frame.h"
+#include "fan.h"
+#include "gather.h"
+#include "parallel.h"
+#include "range.h"
+#include "pipe.h"
+#include "probe.h"
+
+static int mpeg_job_mode(Options *opts)
+{
+    int ret = 1;
+
+    switch (opts->_par_mode)
+    {
+    case PAR_MODE_SCAN:
+    {
+        MpegScan mpeg(opts->_par_inp, opts);
+        ret = mpeg.scan(opts->_par_inp, opts->_par_out);
+    }
+        break;
+    case PAR_MODE_LIST:
+    {
+        MpegList mpeg(opts->_par_inp, opts);
+        ret = mpeg.list(opts->_par_inp, opts->_par_out);
+    }
+        break;
+    case PAR_MODE_REMUX:
+    {
+        MpegRemux mpeg(opts->_par_inp, opts);
+        ret = mpeg.remux(opts->_par_inp, opts->_par_out);
+    }
+        break;
+    case PAR_MODE_DEMUX:
+        if (opts->gather())
+        {
+            MpegGather mpeg(opts->_par_inp, opts);
+            ret = mpeg.gather(opts->_par_inp, opts->_par_out);
+        }
+        else
+        {
+            MpegDemux mpeg(opts->_par_inp, opts);
+            ret = mpeg.demux(opts->_par_inp, opts->_par_out);
+        }
+        break;
+    case PAR_MODE_REWRITE:
+    {
+        MpegRewrite mpeg(opts->_par_inp, opts);
+
+        if (opts->rollback())
+            ret = mpeg.rollback(opts->_par_out);
+        else
+            ret = mpeg.rewrite(opts->_par_inp, opts->_par_out);
+    }
+        break;
+    case PAR_MODE_UNFRAME:
+    {
+        MpegUnframe mpeg(opts->_par_inp, opts);
+        ret = mpeg.unframe(opts->_par_inp, opts->_par_out);
+    }
+        break;
+    case PAR_MODE_MERGE:
+    {
+        MpegRange mpeg(opts);
+        ret = mpeg.merge(opts->_par_inp, opts->_par_out);
+    }
+        break;
+    case PAR_MODE_PROBE:
+    {
+        MpegProbe mpeg(opts->_par_inp, opts);
+        ret = mpeg.probe(opts->_par_inp, opts->_par_out);
+    }
+        break;
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+int mpeg_job_run(Options *opts)
+{
+    int ret = 1;
+    FILE *out = opts->_par_out;
+
+    // give the main output its own writer thread
+    if (opts->threads() && !(opts->_par_mode == PAR_MODE_REMUX && opts->clone()))
+    {
+        opts->_par_out = mpeg_writer_t::open(out, 0);
+
+        if (opts->_par_out == NULL)
+            opts->_par_out = out;
+    }
+
+    if (opts->range() && opts->_par_mode != PAR_MODE_MERGE)
+    {
+        MpegRange mpeg(opts);
+        ret = mpeg.run(opts->_par_inp, opts->_par_out);
+    }
+    else if (opts->_fan_cnt > 0)
+    {
+        MpegFan mpeg(opts->_par_inp, opts);
+        ret = mpeg.fan(opts->_par_inp, opts->_par_out);
+    }
+    else if (MpegParallel::supported(opts))
+    {
+        MpegParallel mpeg(opts);
+        ret = mpeg.run(opts->_par_inp, opts->_par_out);
+    }
+    else
+    {
+        ret = mpeg_job_mode(opts);
+    }
+
+    if (opts->_par_out != out && fclose(opts->_par_out))
+        ret = 1;
+
+    opts->_par_out = out;
+    return ret;
+}
+
+
@@ -0,0 +1,11 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include "options.h"
+
+// run the mode selected in opts on its input and output files
+int mpeg_job_run(Options *opts);
+
+#endif
+
+
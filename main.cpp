@@ -16,8 +16,9 @@
  *****************************************************************************/
 
 #include "options.h"
-#include "buffer.h"
-#include "common.h"
+#include "job.h"
+#include "batch.h"
+#include "server.h"
 
 class Main
 {
@@ -38,37 +39,26 @@ int Main::run(int argc, char **argv)
 {
     Options opts;
     opts.parse(argc, argv);
-    int ret = 1;
+    int ret;
 
-    switch (opts._par_mode)
+    if (opts._listen_name != NULL)
     {
-    case PAR_MODE_SCAN:
-    {
-        MpegScan mpeg(opts._par_inp, &opts);
-        ret = mpeg.scan(opts._par_inp, opts._par_out);
+        MpegServer server(&opts, argv[0]);
+        ret = server.run();
     }
-        break;
-    case PAR_MODE_LIST:
+    else if (opts._connect_name != NULL)
     {
-        MpegList mpeg(opts._par_inp, &opts);
-        ret = mpeg.list(opts._par_inp, opts._par_out);
+        MpegClient client(opts._connect_name);
+        ret = client.run(argc, argv);
     }
-        break;
-    case PAR_MODE_REMUX:
+    else if (opts._batch_name != NULL)
     {
-        MpegRemux mpeg(opts._par_inp, &opts);
-        ret = mpeg.remux(opts._par_inp, opts._par_out);
+        MpegBatch batch(&opts, argv[0]);
+        ret = batch.run();
     }
-        break;
-    case PAR_MODE_DEMUX:
+    else
     {
-        MpegDemux mpeg(opts._par_inp, &opts);
-        ret = mpeg.demux(opts._par_inp, opts._par_out);
-    }
-        break;
-    default:
-        ret = 1;
-        break;
+        ret = mpeg_job_run(&opts);
     }
 
     if (ret)
@@ -22,6 +22,34 @@ static const char *str_skip_white(const char *str)
     return str;
 }
 
+// [[hh:]mm:]ss[.frac] in 90 kHz ticks
+static int str_get_time(const char *str, uint64_t *ret)
+{
+    double val = 0.0;
+    char *end;
+
+    for (unsigned i = 0; i < 3; i++)
+    {
+        double tmp = strtod(str, &end);
+
+        if (end == str || tmp < 0.0)
+            return 1;
+
+        val = 60.0 * val + tmp;
+
+        if (*end != ':')
+            break;
+
+        str = end + 1;
+    }
+
+    if (*end != 0)
+        return 1;
+
+    *ret = uint64_t(val * 90000.0 + 0.5);
+    return 0;
+}
+
 static int
 str_get_streams(const char *str, uint8_t stm[256], unsigned msk)
 {
@@ -118,6 +146,117 @@ Options::Options()
     }
 }
 
+// a copy for another job: same settings, no files and no parser state
+Options::Options(const Options &opts)
+{
+    *this = opts;
+    _par_inp = nullptr;
+    _par_out = nullptr;
+    _arg_inp = nullptr;
+    _arg_out = nullptr;
+    _atend = 0;
+    index1 = -1;
+    index2 = -1;
+    curopt = nullptr;
+    _demux_name = opts._demux_name != NULL ? str_clone(opts._demux_name) : NULL;
+    _inp_name = NULL;
+    _journal_name = opts._journal_name != NULL ? str_clone(opts._journal_name) : NULL;
+    _batch_name = NULL;
+    _listen_name = NULL;
+    _connect_name = NULL;
+    _table_name = NULL;
+    _copy = 1;
+    _fan = NULL;
+    _fan_cnt = 0;
+
+    for (unsigned i = 0; i < opts._fan_cnt; i++)
+        add_fan(opts._fan[i]);
+}
+
+Options::~Options()
+{
+    free(_demux_name);
+    free(_inp_name);
+    free(_journal_name);
+    free(_batch_name);
+    free(_listen_name);
+    free(_connect_name);
+    free(_table_name);
+
+    for (unsigned i = 0; i < _fan_cnt; i++)
+        free(_fan[i]);
+
+    free(_fan);
+}
+
+int Options::add_fan(const char *args)
+{
+    char **fan = (char **)realloc(_fan, (_fan_cnt + 1) * sizeof(char *));
+
+    if (fan == NULL)
+        return 1;
+
+    _fan = fan;
+    _fan[_fan_cnt] = str_clone(args);
+
+    if (_fan[_fan_cnt] == NULL)
+        return 1;
+
+    _fan_cnt += 1;
+    return 0;
+}
+
+// split line into words in place, a word may be in double quotes
+int Options::tokenize(char *line, const char *prog, int *argc, char ***argv)
+{
+    unsigned n = 1;
+
+    for (const char *s = line; *s != 0; s++)
+        if (*s == ' ' || *s == '\t')
+            n += 1;
+
+    char **ret = (char **)malloc((n + 2) * sizeof(char *));
+
+    if (ret == NULL)
+        return 1;
+
+    int cnt = 0;
+    ret[cnt++] = (char *)prog;
+    char *s = line;
+
+    while (true)
+    {
+        while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
+            s += 1;
+
+        if (*s == 0 || *s == '#')
+            break;
+
+        if (*s == '"')
+        {
+            ret[cnt++] = ++s;
+
+            while (*s != 0 && *s != '"')
+                s += 1;
+        }
+        else
+        {
+            ret[cnt++] = s;
+
+            while (*s != 0 && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n')
+                s += 1;
+        }
+
+        if (*s != 0)
+            *s++ = 0;
+    }
+
+    ret[cnt] = NULL;
+    *argc = cnt;
+    *argv = ret;
+    return 0;
+}
+
 uint32_t Options::packet_max() const
 {
     return _packet_max;
@@ -228,6 +367,213 @@ void Options::drop(int val)
     _drop = val;
 }
 
+int Options::direct() const
+{
+    return _direct;
+}
+
+void Options::direct(int val)
+{
+    _direct = val;
+}
+
+int Options::clone() const
+{
+    return _clone;
+}
+
+void Options::clone(int val)
+{
+    _clone = val;
+}
+
+int Options::compact() const
+{
+    return _compact;
+}
+
+void Options::compact(int val)
+{
+    _compact = val;
+}
+
+int Options::framed() const
+{
+    return _framed;
+}
+
+void Options::framed(int val)
+{
+    _framed = val;
+}
+
+int Options::threads() const
+{
+    return _threads;
+}
+
+void Options::threads(int val)
+{
+    _threads = val;
+}
+
+int Options::gather() const
+{
+    return _gather;
+}
+
+void Options::gather(int val)
+{
+    _gather = val;
+}
+
+int Options::checksum() const
+{
+    return _checksum;
+}
+
+void Options::checksum(int val)
+{
+    _checksum = val;
+}
+
+int Options::index() const
+{
+    return _index;
+}
+
+void Options::index(int val)
+{
+    _index = val;
+}
+
+uint64_t Options::seek() const
+{
+    return _seek;
+}
+
+void Options::seek(uint64_t val)
+{
+    _seek = val;
+}
+
+int Options::window() const
+{
+    return _time_from > 0 || _time_to != UINT64_MAX;
+}
+
+uint64_t Options::time_from() const
+{
+    return _time_from;
+}
+
+uint64_t Options::time_to() const
+{
+    return _time_to;
+}
+
+void Options::time_from(uint64_t val)
+{
+    _time_from = val;
+}
+
+void Options::time_to(uint64_t val)
+{
+    _time_to = val;
+}
+
+unsigned Options::probe_windows() const
+{
+    return _probe_windows;
+}
+
+void Options::probe_windows(unsigned val)
+{
+    _probe_windows = val < 1 ? 1 : val;
+}
+
+uint64_t Options::probe_bytes() const
+{
+    return _probe_bytes;
+}
+
+void Options::probe_bytes(uint64_t val)
+{
+    _probe_bytes = val;
+}
+
+uint64_t Options::probe_time() const
+{
+    return _probe_time;
+}
+
+void Options::probe_time(uint64_t val)
+{
+    _probe_time = val;
+}
+
+unsigned Options::chunks() const
+{
+    return _chunks;
+}
+
+void Options::chunks(unsigned val)
+{
+    _chunks = val < 1 ? 1 : val;
+}
+
+unsigned Options::jobs() const
+{
+    return _jobs;
+}
+
+void Options::jobs(unsigned val)
+{
+    _jobs = val;
+}
+
+int Options::dry_run() const
+{
+    return _dry_run;
+}
+
+void Options::dry_run(int val)
+{
+    _dry_run = val;
+}
+
+int Options::rollback() const
+{
+    return _rollback;
+}
+
+void Options::rollback(int val)
+{
+    _rollback = val;
+}
+
+int Options::range() const
+{
+    return _range;
+}
+
+uint64_t Options::range_start() const
+{
+    return _range_start;
+}
+
+uint64_t Options::range_end() const
+{
+    return _range_end;
+}
+
+void Options::range(uint64_t start, uint64_t end)
+{
+    _range = 1;
+    _range_start = start;
+    _range_end = end;
+}
+
 int Options::dvdac3() const
 {
     return _dvdac3;
@@ -238,7 +584,7 @@ void Options::dvdac3(int val)
     _dvdac3 = val;
 }
 
-mpegd_option_t *Options::_find_option_name1(mpegd_option_t *opt, int name1) const
+const mpegd_option_t *Options::_find_option_name1(const mpegd_option_t *opt, int name1) const
 {
     while (opt->name1 >= 0)
     {
@@ -251,8 +597,8 @@ mpegd_option_t *Options::_find_option_name1(mpegd_option_t *opt, int name1) cons
     return nullptr;
 }
 
-mpegd_option_t *
-Options::_find_option_name2(mpegd_option_t *opt, const char *name2) const
+const mpegd_option_t *
+Options::_find_option_name2(const mpegd_option_t *opt, const char *name2) const
 {
     while (opt->name1 >= 0)
     {
@@ -265,37 +611,66 @@ Options::_find_option_name2(mpegd_option_t *opt, const char *name2) const
     return nullptr;
 }
 
-static mpegd_option_t opt[] = {
+static const mpegd_option_t opt[] = {
  { '?', 0, "help", NULL, "Print usage information" },
  { 'a', 0, "ac3", NULL, "Assume DVD AC3 headers in private streams" },
+ { 'A', 1, "fan", "args", "Run another mode on the same read, args are options and output" },
  { 'b', 1, "base-name", "name", "Set the base name for demuxed streams" },
+ { 'B', 1, "batch", "name", "Run a job per manifest line or directory entry" },
  { 'c', 0, "scan", NULL, "Scan the stream [default]" },
+ { 'C', 0, "clone", NULL, "Share unchanged input ranges when remuxing [no]" },
  { 'd', 0, "demux", NULL, "Demultiplex streams" },
  { 'D', 0, "no-drop", NULL, "Don't drop incomplete packets" },
  { 'e', 0, "no-end", NULL, "Don't list end codes [no]" },
  { 'E', 0, "empty-packs", NULL, "Remux empty packs [no]" },
+ { 'f', 0, "framed", NULL, "Demux all streams into one framed output [no]" },
  { 'F', 0, "first-pts", NULL, "Print packet with lowest PTS [no]" },
+ { 'g', 0, "gather", NULL, "Demux in two passes, writing streams in parallel [no]" },
+ { 'G', 0, "merge", NULL, "Merge the partial results of range runs" },
  { 'h', 0, "no-system-headers", NULL, "Don't list system headers" },
+ { 'H', 0, "checksum", NULL, "Print CRC32C checksums of demuxed and remuxed data [no]" },
  { 'i', 1, "invalid", "id", "Select invalid streams [none]" },
+ { 'I', 0, "index", NULL, "Write a sidecar index next to the input when scanning [no]" },
+ { 'j', 1, "journal", "name", "Set the journal name for in-place rewrites" },
+ { 'J', 1, "jobs", "int", "Set the number of batch threads [cores]" },
  { 'k', 0, "no-packs", NULL, "Don't list packs" },
  { 'K', 0, "remux-skipped", NULL, "Copy skipped bytes when remuxing [no]" },
  { 'l', 0, "list", NULL, "List the stream contents" },
+ { 'L', 1, "listen", "name", "Serve jobs on a UNIX socket" },
  { 'm', 1, "packet-max-size", "int", "Set the maximum packet size [0]" },
+ { 'M', 1, "table", "name", "Publish the packet table in shared memory" },
+ { 'n', 0, "dry-run", NULL, "Report in-place rewrites without writing [no]" },
+ { 'N', 1, "chunks", "int", "Parse the input in n parallel chunks [1]" },
+ { 'o', 1, "from", "time", "Only demux or remux packets from [[hh:]mm:]ss[.frac] on [0]" },
+ { 'O', 0, "direct", NULL, "Write stream files with O_DIRECT [no]" },
  { 'p', 1, "substream", "id", "Select substreams [none]" },
  { 'P', 2, "substream-map", "id1 id2", "Remap substream id1 to id2" },
+ { 'q', 1, "to", "time", "Only demux or remux packets up to [[hh:]mm:]ss[.frac] [end]" },
+ { 'Q', 1, "seek", "time", "Start at the last pack before [[hh:]mm:]ss[.frac] [0]" },
  { 'r', 0, "remux", NULL, "Copy modified input to output" },
+ { 'R', 2, "range", "start end", "Only process the packs in [start, end), write a partial result" },
  { 's', 1, "stream", "id", "Select streams [none]" },
  { 'S', 2, "stream-map", "id1 id2", "Remap stream id1 to id2" },
  { 't', 0, "no-packets", NULL, "Don't list packets" },
+ { 'T', 0, "threads", NULL, "Read, parse and write on separate threads [no]" },
  { 'u', 0, "spu", NULL, "Assume DVD subtitles in private streams" },
+ { 'U', 0, "rollback", NULL, "Roll back an interrupted in-place rewrite" },
+ { 'v', 0, "probe", NULL, "Probe the streams within a read budget" },
  { 'V', 0, "version", NULL, "Print version information" },
+ { 'w', 0, "rewrite", NULL, "Remap stream ids in place" },
+ { 'W', 1, "probe-windows", "int", "Set the number of windows a probe reads [8]" },
  { 'x', 0, "split", NULL, "Split sequences while remuxing [no]" },
+ { 'X', 1, "connect", "name", "Run the job on the server at a UNIX socket" },
+ { 'y', 0, "unframe", NULL, "Split a framed output into streams" },
+ { 'Y', 1, "probe-bytes", "int", "Stop a probe after reading n bytes, 0 for no limit [4194304]" },
+ { 'z', 1, "probe-time", "time", "Stop a probe after [[hh:]mm:]ss[.frac] of SCR time [none]" },
+ { 'Z', 0, "compact", NULL, "Drop padding and empty packs when remuxing [no]" },
  {  -1, 0, NULL, NULL, NULL }
 };
 
 int Options::mpegd_getopt(int argc, char **argv, char ***optarg)
 {
-    mpegd_option_t *ret;
+    const mpegd_option_t *ret;
 
     if (index1 < 0)
     {
@@ -416,6 +791,11 @@ int Options::parse(int argc, char **argv)
             return 0;
         case 'a':
             dvdac3(1);
+            break;
+        case 'A':
+            if (add_fan(optarg[0]))
+                return 1;
+
             break;
         case 'b':
             if (_demux_name != NULL)
@@ -423,6 +803,12 @@ int Options::parse(int argc, char **argv)
 
             _demux_name = str_clone(optarg[0]);
             break;
+        case 'B':
+            if (_batch_name != NULL)
+                free(_batch_name);
+
+            _batch_name = str_clone(optarg[0]);
+            break;
         case 'c':
             _par_mode = PAR_MODE_SCAN;
 
@@ -432,6 +818,9 @@ int Options::parse(int argc, char **argv)
                 _par_substream[i] |= PAR_STREAM_SELECT;
             }
             break;
+        case 'C':
+            clone(1);
+            break;
         case 'd':
             _par_mode = PAR_MODE_DEMUX;
             break;
@@ -444,12 +833,24 @@ int Options::parse(int argc, char **argv)
         case 'E':
             empty_pack(1);
             break;
+        case 'f':
+            framed(1);
+            break;
         case 'F':
             first_pts(1);
             break;
+        case 'g':
+            gather(1);
+            break;
+        case 'G':
+            _par_mode = PAR_MODE_MERGE;
+            break;
         case 'h':
             no_shdr(1);
             break;
+        case 'H':
+            checksum(1);
+            break;
         case 'i':
             if (strcmp(optarg[0], "-") == 0)
             {
@@ -470,6 +871,18 @@ int Options::parse(int argc, char **argv)
                 }
             }
             break;
+        case 'I':
+            index(1);
+            break;
+        case 'j':
+            if (_journal_name != NULL)
+                free(_journal_name);
+
+            _journal_name = str_clone(optarg[0]);
+            break;
+        case 'J':
+            jobs(unsigned(strtoul(optarg[0], NULL, 0)));
+            break;
         case 'k':
             no_pack(1);
             break;
@@ -479,9 +892,37 @@ int Options::parse(int argc, char **argv)
         case 'l':
             _par_mode = PAR_MODE_LIST;
             break;
+        case 'L':
+            if (_listen_name != NULL)
+                free(_listen_name);
+
+            _listen_name = str_clone(optarg[0]);
+            break;
         case 'm':
             packet_max(unsigned(strtoul(optarg[0], NULL, 0)));
             break;
+        case 'M':
+            if (_table_name != NULL)
+                free(_table_name);
+
+            _table_name = str_clone(optarg[0]);
+            break;
+        case 'n':
+            dry_run(1);
+            break;
+        case 'N':
+            chunks(unsigned(strtoul(optarg[0], NULL, 0)));
+            break;
+        case 'o':
+            if (str_get_time(optarg[0], &_time_from))
+            {
+                fprintf(stderr, "%s: bad time (%s)\n", argv[0], optarg[0]);
+                return 1;
+            }
+            break;
+        case 'O':
+            direct(1);
+            break;
         case 'p':
             if (str_get_streams(optarg[0], _par_substream, PAR_STREAM_SELECT))
             {
@@ -496,9 +937,26 @@ int Options::parse(int argc, char **argv)
             _par_substream_map[id1 & 0xff] = id2 & 0xff;
         }
             break;
+        case 'q':
+            if (str_get_time(optarg[0], &_time_to))
+            {
+                fprintf(stderr, "%s: bad time (%s)\n", argv[0], optarg[0]);
+                return 1;
+            }
+            break;
+        case 'Q':
+            if (str_get_time(optarg[0], &_seek))
+            {
+                fprintf(stderr, "%s: bad time (%s)\n", argv[0], optarg[0]);
+                return 1;
+            }
+            break;
         case 'r':
             _par_mode = PAR_MODE_REMUX;
             break;
+        case 'R':
+            range(strtoull(optarg[0], NULL, 0), strtoull(optarg[1], NULL, 0));
+            break;
         case 's':
             if (str_get_streams(optarg[0], _par_stream, PAR_STREAM_SELECT))
             {
@@ -516,45 +974,61 @@ int Options::parse(int argc, char **argv)
         case 't':
             no_packet(1);
             break;
+        case 'T':
+            threads(1);
+            break;
         case 'u':
             dvdsub(1);
             break;
+        case 'U':
+            _par_mode = PAR_MODE_REWRITE;
+            rollback(1);
+            break;
+        case 'v':
+            _par_mode = PAR_MODE_PROBE;
+            break;
         case 'V':
             //print_version();
             return 0;
+        case 'w':
+            _par_mode = PAR_MODE_REWRITE;
+            break;
+        case 'W':
+            probe_windows(unsigned(strtoul(optarg[0], NULL, 0)));
+            break;
         case 'x':
             split(1);
             break;
+        case 'X':
+            if (_connect_name != NULL)
+                free(_connect_name);
+
+            _connect_name = str_clone(optarg[0]);
+            break;
+        case 'y':
+            _par_mode = PAR_MODE_UNFRAME;
+            break;
+        case 'Y':
+            probe_bytes(strtoull(optarg[0], NULL, 0));
+            break;
+        case 'z':
+            if (str_get_time(optarg[0], &_probe_time))
+            {
+                fprintf(stderr, "%s: bad time (%s)\n", argv[0], optarg[0]);
+                return 1;
+            }
+            break;
+        case 'Z':
+            compact(1);
+            break;
         case 0:
-            if (_par_inp == nullptr)
+            if (_arg_inp == nullptr)
             {
-                if (strcmp(optarg[0], "-") == 0)
-                    _par_inp = stdin;
-                else
-                    _par_inp = fopen(optarg[0], "rb");
-
-                if (_par_inp == nullptr)
-                {
-                    fprintf(stderr, "%s: can't open input file (%s)\n",
-                                argv[0], optarg[0]);
-
-                    return 1;
-                }
+                _arg_inp = optarg[0];
             }
-            else if (_par_out == nullptr)
+            else if (_arg_out == nullptr)
             {
-                if (strcmp(optarg[0], "-") == 0)
-                    _par_out = stdout;
-                else
-                    _par_out = fopen(optarg[0], "wb");
-
-                if (_par_out == NULL)
-                {
-                    fprintf(stderr, "%s: can't open output file (%s)\n",
-                                argv[0], optarg[0]);
-
-                    return 1;
-                }
+                _arg_out = optarg[0];
             }
             else
             {
@@ -567,11 +1041,41 @@ int Options::parse(int argc, char **argv)
         }
     }
 
-    if (_par_inp == nullptr)
+    // batch, server and client runs and copies for a job open their own files
+    if (_batch_name != NULL || _listen_name != NULL || _connect_name != NULL || _copy)
+        return 0;
+
+    return open(argv[0]);
+}
+
+int Options::open(const char *prog)
+{
+    if (_arg_inp == nullptr || strcmp(_arg_inp, "-") == 0)
+    {
         _par_inp = stdin;
+    }
+    else
+    {
+        _par_inp = fopen(_arg_inp, "rb");
+        _inp_name = str_clone(_arg_inp);
+    }
 
-    if (_par_out == nullptr)
+    if (_par_inp == nullptr)
+    {
+        fprintf(stderr, "%s: can't open input file (%s)\n", prog, _arg_inp);
+        return 1;
+    }
+
+    if (_arg_out == nullptr || strcmp(_arg_out, "-") == 0)
         _par_out = stdout;
+    else
+        _par_out = fopen(_arg_out, "wb");
+
+    if (_par_out == NULL)
+    {
+        fprintf(stderr, "%s: can't open output file (%s)\n", prog, _arg_out);
+        return 1;
+    }
 
     return 0;
 }
@@ -23,6 +23,10 @@ static constexpr uint8_t PAR_MODE_SCAN = 0;
 static constexpr uint8_t PAR_MODE_LIST = 1;
 static constexpr uint8_t PAR_MODE_REMUX = 2;
 static constexpr uint8_t PAR_MODE_DEMUX = 3;
+static constexpr uint8_t PAR_MODE_REWRITE = 4;
+static constexpr uint8_t PAR_MODE_UNFRAME = 5;
+static constexpr uint8_t PAR_MODE_MERGE = 6;
+static constexpr uint8_t PAR_MODE_PROBE = 7;
 
 class Options
 {
@@ -39,14 +43,40 @@ private:
     int _split = 0;
     int _dvdac3 = 0;
     int _drop = 1;
+    int _direct = 0;
+    int _clone = 0;
+    int _dry_run = 0;
+    int _compact = 0;
+    int _framed = 0;
+    int _threads = 0;
+    int _gather = 0;
+    int _checksum = 0;
+    int _index = 0;
+    uint64_t _seek = 0;
+    uint64_t _time_from = 0;
+    uint64_t _time_to = UINT64_MAX;
+    unsigned _probe_windows = 8;
+    uint64_t _probe_bytes = 4194304;
+    uint64_t _probe_time = 0;
+    unsigned _chunks = 1;
+    unsigned _jobs = 0;
+    int _rollback = 0;
+    int _range = 0;
+    uint64_t _range_start = 0;
+    uint64_t _range_end = UINT64_MAX;
     int _atend = 0;
+    int _copy = 0;
     int index1 = -1;
     int index2 = -1;
     const char *curopt = nullptr;
-    mpegd_option_t *_find_option_name1(mpegd_option_t *opt, int name1) const;
-    mpegd_option_t *_find_option_name2(mpegd_option_t *opt, const char *name2) const;
+    const mpegd_option_t *_find_option_name1(const mpegd_option_t *opt, int name1) const;
+    const mpegd_option_t *_find_option_name2(const mpegd_option_t *opt, const char *name2) const;
+    Options &operator=(const Options &opts) = default;
+    int add_fan(const char *args);
 public:
     Options();
+    Options(const Options &opts);
+    ~Options();
     FILE *_par_inp = nullptr;
     FILE *_par_out = nullptr;
     uint8_t _par_mode = PAR_MODE_SCAN;
@@ -55,6 +85,16 @@ public:
     uint8_t _par_stream_map[256];
     uint8_t _par_substream_map[256];
     char *_demux_name = nullptr;
+    char *_inp_name = nullptr;
+    char *_journal_name = nullptr;
+    char *_batch_name = nullptr;
+    char *_listen_name = nullptr;
+    char *_connect_name = nullptr;
+    char *_table_name = nullptr;
+    char **_fan = nullptr;
+    unsigned _fan_cnt = 0;
+    const char *_arg_inp = nullptr;
+    const char *_arg_out = nullptr;
     int mpegd_getopt(int argc, char **argv, char ***optarg);
     uint32_t packet_max() const;
     void packet_max(uint32_t val);
@@ -80,7 +120,50 @@ public:
     void dvdac3(int val);
     int drop() const;
     void drop(int val);
+    int direct() const;
+    void direct(int val);
+    int clone() const;
+    void clone(int val);
+    int compact() const;
+    void compact(int val);
+    int framed() const;
+    void framed(int val);
+    int threads() const;
+    void threads(int val);
+    int gather() const;
+    void gather(int val);
+    int checksum() const;
+    void checksum(int val);
+    int index() const;
+    void index(int val);
+    uint64_t seek() const;
+    void seek(uint64_t val);
+    int window() const;
+    uint64_t time_from() const;
+    uint64_t time_to() const;
+    void time_from(uint64_t val);
+    void time_to(uint64_t val);
+    unsigned probe_windows() const;
+    void probe_windows(unsigned val);
+    uint64_t probe_bytes() const;
+    void probe_bytes(uint64_t val);
+    uint64_t probe_time() const;
+    void probe_time(uint64_t val);
+    unsigned chunks() const;
+    void chunks(unsigned val);
+    unsigned jobs() const;
+    void jobs(unsigned val);
+    int dry_run() const;
+    void dry_run(int val);
+    int rollback() const;
+    void rollback(int val);
+    int range() const;
+    uint64_t range_start() const;
+    uint64_t range_end() const;
+    void range(uint64_t start, uint64_t end);
     int parse(int argc, char **argv);
+    int open(const char *prog);
+    static int tokenize(char *line, const char *prog, int *argc, char ***argv);
 };
 
 #endif
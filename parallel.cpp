@@ -0,0 +1,257 @@
+#include "parallel.h"
+#include "options.h"
+#include "sync.h"
+#include <cstdlib>
+#include <thread>
+#include <sys/stat.h>
+
+MpegParallel::MpegParallel(const Options *options) : _options(options)
+{
+}
+
+MpegParallel::~MpegParallel()
+{
+    for (unsigned i = 0; i < _cnt; i++)
+        mpeg_parallel_free(i);
+
+    free(_start);
+    free(_end);
+    free(_part);
+    free(_inp);
+    free(_out);
+    free(_ret);
+}
+
+// chunks need a named input and a mode they can be merged in
+int MpegParallel::supported(const Options *options)
+{
+    if (options->chunks() < 2 || options->_inp_name == NULL || options->_fan_cnt > 0
+        || options->_table_name != NULL || options->index() || options->seek() > 0)
+        return 0;
+
+    return mergeable(options);
+}
+
+// modes and options whose output does not depend on earlier chunks
+int MpegParallel::mergeable(const Options *options)
+{
+    // packet times are counted from the first pack
+    if (options->window())
+        return 0;
+
+    switch (options->_par_mode)
+    {
+    case PAR_MODE_SCAN:
+    case PAR_MODE_LIST:
+        return 1;
+    case PAR_MODE_DEMUX:
+        return options->dvdsub() == 0 && options->gather() == 0;
+    case PAR_MODE_REMUX:
+        return options->split() == 0 && options->compact() == 0 &&
+            options->clone() == 0 && options->no_shdr() == 0;
+    default:
+        return 0;
+    }
+}
+
+int MpegParallel::mpeg_parallel_bounds(FILE *inp, unsigned cnt)
+{
+    struct stat st;
+
+    if (fstat(fileno(inp), &st) || !S_ISREG(st.st_mode))
+        return 1;
+
+    uint64_t size = uint64_t(st.st_size);
+
+    if (cnt > size / MPEG_CHUNK_MIN)
+        cnt = unsigned(size / MPEG_CHUNK_MIN);
+
+    if (cnt < 1)
+        cnt = 1;
+
+    _start = (uint64_t *)calloc(cnt, sizeof(uint64_t));
+    _end = (uint64_t *)calloc(cnt, sizeof(uint64_t));
+    _part = (mpeg_demux_t **)calloc(cnt, sizeof(mpeg_demux_t *));
+    _inp = (FILE **)calloc(cnt, sizeof(FILE *));
+    _out = (FILE **)calloc(cnt, sizeof(FILE *));
+    _ret = (int *)calloc(cnt, sizeof(int));
+
+    if (!_start || !_end || !_part || !_inp || !_out || !_ret)
+        return 1;
+
+    // the first chunk starts wherever a single parse starts
+    _cnt = 1;
+
+    for (unsigned i = 1; i < cnt; i++)
+    {
+        uint64_t ofs;
+
+        if (mpeg_sync_pack(fileno(inp), size * i / cnt, size, &ofs))
+            break;
+
+        if (ofs <= _start[_cnt - 1])
+            continue;
+
+        _start[_cnt++] = ofs;
+    }
+
+    for (unsigned i = 0; i < _cnt; i++)
+        _end[i] = i + 1 < _cnt ? _start[i + 1] : UINT64_MAX;
+
+    return 0;
+}
+
+void MpegParallel::mpeg_parallel_run(unsigned i)
+{
+    _ret[i] = 1;
+    _inp[i] = fopen(_options->_inp_name, "rb");
+    _out[i] = tmpfile();
+
+    if (_inp[i] == NULL || _out[i] == NULL)
+        return;
+
+    switch (_options->_par_mode)
+    {
+    case PAR_MODE_SCAN:
+    {
+        MpegScan *mpeg = new MpegScan(_inp[i], _options);
+        _part[i] = mpeg;
+        mpeg->range(_start[i], _end[i], 1);
+        _ret[i] = mpeg->scan(_inp[i], _out[i]);
+    }
+        break;
+    case PAR_MODE_LIST:
+    {
+        MpegList *mpeg = new MpegList(_inp[i], _options);
+        _part[i] = mpeg;
+        mpeg->range(_start[i], _end[i], 1);
+        _ret[i] = mpeg->list(_inp[i], _out[i]);
+    }
+        break;
+    case PAR_MODE_REMUX:
+    {
+        MpegRemux *mpeg = new MpegRemux(_inp[i], _options);
+        _part[i] = mpeg;
+        mpeg->range(_start[i], _end[i], 1);
+        _ret[i] = mpeg->remux(_inp[i], _out[i]);
+    }
+        break;
+    case PAR_MODE_DEMUX:
+    {
+        MpegDemux *mpeg = new MpegDemux(_inp[i], _options);
+        _part[i] = mpeg;
+        mpeg->range(_start[i], _end[i], 1);
+        _ret[i] = mpeg->demux(_inp[i], _out[i]);
+    }
+        break;
+    }
+
+    // the partial outputs are read back by the merge
+    if (fflush(_out[i]))
+        _ret[i] = 1;
+}
+
+void MpegParallel::mpeg_parallel_free(unsigned i)
+{
+    delete _part[i];
+    _part[i] = nullptr;
+
+    if (_inp[i] != NULL)
+        fclose(_inp[i]);
+
+    if (_out[i] != NULL)
+        fclose(_out[i]);
+
+    _inp[i] = NULL;
+    _out[i] = NULL;
+}
+
+int MpegParallel::mpeg_parallel_merge(FILE *out)
+{
+    switch (_options->_par_mode)
+    {
+    case PAR_MODE_SCAN:
+    {
+        MpegScan mpeg(NULL, _options);
+        return mpeg.scan_merge((MpegScan **)_part, _cnt, out);
+    }
+    case PAR_MODE_LIST:
+    {
+        MpegList mpeg(NULL, _options);
+        return mpeg.list_merge((MpegList **)_part, _cnt, out);
+    }
+    case PAR_MODE_REMUX:
+    {
+        MpegRemux mpeg(NULL, _options);
+        return mpeg.remux_merge((MpegRemux **)_part, _cnt, out);
+    }
+    case PAR_MODE_DEMUX:
+    {
+        MpegDemux mpeg(NULL, _options);
+        return mpeg.demux_merge((MpegDemux **)_part, _cnt, out);
+    }
+    }
+
+    return 1;
+}
+
+int MpegParallel::run(FILE *inp, FILE *out)
+{
+    if (mpeg_parallel_bounds(inp, _options->chunks()))
+    {
+        fprintf(stderr, "chunks: can't split input\n");
+        return 1;
+    }
+
+    std::thread *th = new std::thread[_cnt];
+
+    for (unsigned i = 0; i < _cnt; i++)
+        th[i] = std::thread(&MpegParallel::mpeg_parallel_run, this, i);
+
+    for (unsigned i = 0; i < _cnt; i++)
+        th[i].join();
+
+    delete[] th;
+    int r = 0;
+
+    /*
+     * A chunk must start exactly where the previous one stopped. If a
+     * resync point was a false pack start, or an error ended the previous
+     * chunk early, redo the chunk from where a single parse would be.
+     */
+    for (unsigned i = 1; i < _cnt; i++)
+    {
+        if (_ret[i - 1])
+        {
+            for (unsigned j = i; j < _cnt; j++)
+                mpeg_parallel_free(j);
+
+            _cnt = i;
+            break;
+        }
+
+        uint64_t ofs = _part[i - 1]->_ofs;
+
+        if (_part[i] != NULL && ofs == _start[i])
+            continue;
+
+        mpeg_parallel_free(i);
+        _start[i] = ofs;
+
+        if (_end[i] < ofs)
+            _end[i] = ofs;
+
+        mpeg_parallel_run(i);
+    }
+
+    for (unsigned i = 0; i < _cnt; i++)
+        if (_part[i] == NULL || _ret[i])
+            r = 1;
+
+    if (_cnt > 0 && _part[_cnt - 1] != NULL && mpeg_parallel_merge(out))
+        r = 1;
+
+    return r;
+}
+
+
@@ -0,0 +1,38 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "common.h"
+
+static constexpr uint64_t MPEG_CHUNK_MIN = 1 << 20;
+
+/*
+ * Splits a seekable input into chunks at resynchronized pack starts,
+ * parses the chunks on separate threads into temporary outputs and
+ * merges them in input order. The result matches a single parse.
+ */
+class MpegParallel
+{
+private:
+    const Options *_options;
+    unsigned _cnt = 0;
+    uint64_t *_start = nullptr;
+    uint64_t *_end = nullptr;
+    mpeg_demux_t **_part = nullptr;
+    FILE **_inp = nullptr;
+    FILE **_out = nullptr;
+    int *_ret = nullptr;
+    int mpeg_parallel_bounds(FILE *inp, unsigned cnt);
+    void mpeg_parallel_run(unsigned i);
+    void mpeg_parallel_free(unsigned i);
+    int mpeg_parallel_merge(FILE *out);
+public:
+    MpegParallel(const Options *options);
+    ~MpegParallel();
+    static int supported(const Options *options);
+    static int mergeable(const Options *options);
+    int run(FILE *inp, FILE *out);
+};
+
+#endif
+
+
@@ -0,0 +1,328 @@
+#include "pipe.h"
+#include <cstdlib>
+#include <cstring>
+
+static void mpeg_pipe_wait(unsigned &spin)
+{
+    spin += 1;
+
+    if (spin < 64)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+int mpeg_ring_t::init(unsigned size)
+{
+    unsigned n = 1;
+
+    while (n < size)
+        n *= 2;
+
+    _slot = (void **)calloc(n, sizeof(void *));
+
+    if (_slot == NULL)
+        return 1;
+
+    _mask = n - 1;
+    _head.store(0);
+    _tail.store(0);
+    return 0;
+}
+
+void mpeg_ring_t::free()
+{
+    ::free(_slot);
+    _slot = nullptr;
+}
+
+int mpeg_ring_t::push(void *p)
+{
+    unsigned tail = _tail.load(std::memory_order_relaxed);
+
+    if (tail - _head.load(std::memory_order_acquire) > _mask)
+        return 1;
+
+    _slot[tail & _mask] = p;
+    _tail.store(tail + 1, std::memory_order_release);
+    return 0;
+}
+
+void *mpeg_ring_t::pop()
+{
+    unsigned head = _head.load(std::memory_order_relaxed);
+
+    if (head == _tail.load(std::memory_order_acquire))
+        return nullptr;
+
+    void *p = _slot[head & _mask];
+    _head.store(head + 1, std::memory_order_release);
+    return p;
+}
+
+void mpeg_ring_t::put(void *p)
+{
+    unsigned spin = 0;
+
+    while (push(p))
+        mpeg_pipe_wait(spin);
+}
+
+void *mpeg_ring_t::get(const std::atomic<int> *stop)
+{
+    unsigned spin = 0;
+    void *p;
+
+    while ((p = pop()) == nullptr)
+    {
+        if (stop != nullptr && stop->load())
+            return nullptr;
+
+        mpeg_pipe_wait(spin);
+    }
+
+    return p;
+}
+
+int mpeg_reader_t::start(FILE *fp)
+{
+    _fp = fp;
+    _stop.store(0);
+    _cur = nullptr;
+    _pos = 0;
+    _eof = 0;
+
+    if (_full.init(MPEG_PIPE_BLOCKS) || _free.init(MPEG_PIPE_BLOCKS))
+        return 1;
+
+    for (unsigned i = 0; i < MPEG_PIPE_BLOCKS; i++)
+    {
+        _blk[i].buf = (uint8_t *)malloc(MPEG_PIPE_BLOCK);
+        _blk[i].cnt = 0;
+
+        if (_blk[i].buf == NULL)
+            return 1;
+
+        _free.put(&_blk[i]);
+    }
+
+    _thread = std::thread(&mpeg_reader_t::_run, this);
+    return 0;
+}
+
+void mpeg_reader_t::_run()
+{
+    while (true)
+    {
+        mpeg_block_t *b = (mpeg_block_t *)_free.get(&_stop);
+
+        if (b == nullptr)
+            break;
+
+        b->cnt = uint32_t(fread(b->buf, 1, MPEG_PIPE_BLOCK, _fp));
+        _full.put(b);
+
+        // an empty block marks the end of the input
+        if (b->cnt == 0)
+            break;
+    }
+}
+
+size_t mpeg_reader_t::read(void *buf, size_t n)
+{
+    uint8_t *tmp = (uint8_t *)buf;
+    size_t ret = 0;
+
+    while (n > 0)
+    {
+        if (_cur == nullptr)
+        {
+            if (_eof)
+                break;
+
+            _cur = (mpeg_block_t *)_full.get();
+            _pos = 0;
+
+            if (_cur->cnt == 0)
+            {
+                _eof = 1;
+                _free.put(_cur);
+                _cur = nullptr;
+                break;
+            }
+        }
+
+        size_t i = _cur->cnt - _pos;
+
+        if (i > n)
+            i = n;
+
+        memcpy(tmp, _cur->buf + _pos, i);
+        _pos += uint32_t(i);
+        tmp += i;
+        ret += i;
+        n -= i;
+
+        if (_pos == _cur->cnt)
+        {
+            _free.put(_cur);
+            _cur = nullptr;
+        }
+    }
+
+    return ret;
+}
+
+void mpeg_reader_t::stop()
+{
+    if (_thread.joinable())
+    {
+        _stop.store(1);
+        _thread.join();
+    }
+
+    for (unsigned i = 0; i < MPEG_PIPE_BLOCKS; i++)
+    {
+        ::free(_blk[i].buf);
+        _blk[i].buf = nullptr;
+    }
+
+    _full.free();
+    _free.free();
+}
+
+FILE *mpeg_writer_t::open(FILE *fp, int close_fp)
+{
+    if (fp == NULL)
+        return NULL;
+
+    mpeg_writer_t *w = new mpeg_writer_t;
+    w->_fp = fp;
+    w->_close_fp = close_fp;
+
+    for (unsigned i = 0; i < MPEG_PIPE_BLOCKS; i++)
+    {
+        w->_blk[i].buf = (uint8_t *)malloc(MPEG_PIPE_BLOCK);
+        w->_blk[i].cnt = 0;
+    }
+
+    FILE *ret = NULL;
+
+    if (w->_full.init(MPEG_PIPE_BLOCKS + 1) == 0 && w->_free.init(MPEG_PIPE_BLOCKS) == 0)
+    {
+        cookie_io_functions_t io = { NULL, _write, NULL, _close };
+        ret = fopencookie(w, "wb", io);
+
+        for (unsigned i = 0; i < MPEG_PIPE_BLOCKS; i++)
+            if (w->_blk[i].buf == NULL)
+                ret = NULL;
+    }
+
+    if (ret == NULL)
+    {
+        w->_free_blocks();
+        delete w;
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < MPEG_PIPE_BLOCKS; i++)
+        w->_free.put(&w->_blk[i]);
+
+    // blocks are filled directly, stdio buffering would copy twice
+    setvbuf(ret, NULL, _IONBF, 0);
+    w->_thread = std::thread(&mpeg_writer_t::_run, w);
+    return ret;
+}
+
+void mpeg_writer_t::_run()
+{
+    while (true)
+    {
+        mpeg_block_t *b = (mpeg_block_t *)_full.get();
+
+        if (b->cnt == 0)
+            break;
+
+        if (_err.load() == 0)
+            if (fwrite(b->buf, 1, b->cnt, _fp) != b->cnt)
+                _err.store(1);
+
+        b->cnt = 0;
+        _free.put(b);
+    }
+}
+
+ssize_t mpeg_writer_t::_write(void *cookie, const char *buf, size_t n)
+{
+    mpeg_writer_t *w = (mpeg_writer_t *)cookie;
+    size_t ret = n;
+
+    if (w->_err.load())
+        return -1;
+
+    while (n > 0)
+    {
+        if (w->_cur == nullptr)
+            w->_cur = (mpeg_block_t *)w->_free.get();
+
+        mpeg_block_t *b = w->_cur;
+        size_t i = MPEG_PIPE_BLOCK - b->cnt;
+
+        if (i > n)
+            i = n;
+
+        memcpy(b->buf + b->cnt, buf, i);
+        b->cnt += uint32_t(i);
+        buf += i;
+        n -= i;
+
+        if (b->cnt == MPEG_PIPE_BLOCK)
+        {
+            w->_full.put(b);
+            w->_cur = nullptr;
+        }
+    }
+
+    return ssize_t(ret);
+}
+
+int mpeg_writer_t::_close(void *cookie)
+{
+    mpeg_writer_t *w = (mpeg_writer_t *)cookie;
+
+    if (w->_cur != nullptr && w->_cur->cnt > 0)
+        w->_full.put(w->_cur);
+
+    // an empty block stops the writer thread
+    w->_full.put(&w->_end);
+    w->_thread.join();
+    int r = w->_err.load() ? -1 : 0;
+
+    if (w->_close_fp)
+    {
+        if (fclose(w->_fp))
+            r = -1;
+    }
+    else if (fflush(w->_fp))
+    {
+        r = -1;
+    }
+
+    w->_free_blocks();
+    delete w;
+    return r;
+}
+
+void mpeg_writer_t::_free_blocks()
+{
+    for (unsigned i = 0; i < MPEG_PIPE_BLOCKS; i++)
+    {
+        free(_blk[i].buf);
+        _blk[i].buf = nullptr;
+    }
+
+    _full.free();
+    _free.free();
+}
+
+
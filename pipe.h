@@ -0,0 +1,83 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include <inttypes.h>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <sys/types.h>
+
+static constexpr unsigned MPEG_PIPE_BLOCK = 65536;
+static constexpr unsigned MPEG_PIPE_BLOCKS = 16;
+
+struct mpeg_block_t
+{
+    uint8_t *buf;
+    uint32_t cnt;
+};
+
+/*
+ * Bounded lock-free ring for exactly one producer and one consumer.
+ * put() and get() wait while the ring is full or empty, which gives
+ * the pipeline its backpressure.
+ */
+class mpeg_ring_t
+{
+private:
+    void **_slot = nullptr;
+    unsigned _mask = 0;
+    std::atomic<unsigned> _head{0};
+    std::atomic<unsigned> _tail{0};
+public:
+    int init(unsigned size);
+    void free();
+    int push(void *p);
+    void *pop();
+    void put(void *p);
+    void *get(const std::atomic<int> *stop = nullptr);
+};
+
+// input thread, reads blocks ahead of the parser
+class mpeg_reader_t
+{
+private:
+    FILE *_fp = nullptr;
+    std::thread _thread;
+    std::atomic<int> _stop{0};
+    mpeg_ring_t _full;
+    mpeg_ring_t _free;
+    mpeg_block_t _blk[MPEG_PIPE_BLOCKS];
+    mpeg_block_t *_cur = nullptr;
+    uint32_t _pos = 0;
+    int _eof = 0;
+    void _run();
+public:
+    int start(FILE *fp);
+    size_t read(void *buf, size_t n);
+    void stop();
+};
+
+// output thread behind a FILE, one per output sink
+class mpeg_writer_t
+{
+private:
+    FILE *_fp = nullptr;
+    int _close_fp = 0;
+    std::thread _thread;
+    std::atomic<int> _err{0};
+    mpeg_ring_t _full;
+    mpeg_ring_t _free;
+    mpeg_block_t _blk[MPEG_PIPE_BLOCKS];
+    mpeg_block_t _end = { nullptr, 0 };
+    mpeg_block_t *_cur = nullptr;
+    void _run();
+    void _free_blocks();
+    static ssize_t _write(void *cookie, const char *buf, size_t n);
+    static int _close(void *cookie);
+public:
+    static FILE *open(FILE *fp, int close_fp);
+};
+
+#endif
+
+
@@ -0,0 +1,82 @@
+#include "pool.h"
+#include <inttypes.h>
+#include <thread>
+
+unsigned mpeg_pool_t::cores()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+int mpeg_pool_t::_take(unsigned self, unsigned *job)
+{
+    for (unsigned k = 0; k < _cnt; k++)
+    {
+        queue_t *q = &_queue[(self + k) % _cnt];
+        std::lock_guard<std::mutex> lock(q->lock);
+
+        if (q->jobs.empty())
+            continue;
+
+        if (k == 0)
+        {
+            *job = q->jobs.front();
+            q->jobs.pop_front();
+        }
+        else
+        {
+            *job = q->jobs.back();
+            q->jobs.pop_back();
+        }
+
+        return 0;
+    }
+
+    return 1;
+}
+
+void mpeg_pool_t::_run(unsigned self)
+{
+    unsigned job;
+
+    // no job is ever added, so all queues empty means done
+    while (_take(self, &job) == 0)
+        _fn(_ctx, job);
+}
+
+int mpeg_pool_t::run(unsigned n, unsigned threads, mpeg_pool_fn_t fn, void *ctx)
+{
+    if (threads < 1)
+        threads = cores();
+
+    if (threads > n)
+        threads = n;
+
+    if (threads < 1)
+        return 0;
+
+    _queue = new queue_t[threads];
+    _cnt = threads;
+    _fn = fn;
+    _ctx = ctx;
+
+    // neighbouring jobs start on the same thread
+    for (unsigned i = 0; i < n; i++)
+        _queue[uint64_t(i) * threads / n].jobs.push_back(i);
+
+    std::thread *th = new std::thread[threads];
+
+    for (unsigned i = 0; i < threads; i++)
+        th[i] = std::thread(&mpeg_pool_t::_run, this, i);
+
+    for (unsigned i = 0; i < threads; i++)
+        th[i].join();
+
+    delete[] th;
+    delete[] _queue;
+    _queue = nullptr;
+    _cnt = 0;
+    return 0;
+}
+
+
@@ -0,0 +1,36 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <deque>
+#include <mutex>
+
+typedef void (*mpeg_pool_fn_t)(void *ctx, unsigned job);
+
+/*
+ * Runs jobs 0 to n-1 on a fixed set of threads. Every thread owns a
+ * queue of job numbers and takes from its front, a thread that runs
+ * dry steals from the back of the others.
+ */
+class mpeg_pool_t
+{
+private:
+    struct queue_t
+    {
+        std::mutex lock;
+        std::deque<unsigned> jobs;
+    };
+
+    queue_t *_queue = nullptr;
+    unsigned _cnt = 0;
+    mpeg_pool_fn_t _fn = nullptr;
+    void *_ctx = nullptr;
+    int _take(unsigned self, unsigned *job);
+    void _run(unsigned self);
+public:
+    static unsigned cores();
+    int run(unsigned n, unsigned threads, mpeg_pool_fn_t fn, void *ctx);
+};
+
+#endif
+
+
@@ -0,0 +1,231 @@
+#include "probe.h"
+#include "options.h"
+#include "sync.h"
+#include <cstring>
+
+static const char *mpeg_probe_kind(unsigned sid)
+{
+    if (sid >= 0xe0 && sid <= 0xef)
+        return "video";
+
+    if (sid >= 0xc0 && sid <= 0xdf)
+        return "audio";
+
+    if (sid == 0xbd)
+        return "private 1";
+
+    if (sid == 0xbe)
+        return "padding";
+
+    if (sid == 0xbf)
+        return "private 2";
+
+    return "other";
+}
+
+// substreams of private stream 1 as used on DVDs
+static const char *mpeg_probe_subkind(unsigned ssid)
+{
+    if (ssid >= 0x20 && ssid <= 0x3f)
+        return "subpicture";
+
+    if (ssid >= 0x80 && ssid <= 0x87)
+        return "ac3";
+
+    if (ssid >= 0x88 && ssid <= 0x8f)
+        return "dts";
+
+    if (ssid >= 0xa0 && ssid <= 0xa7)
+        return "lpcm";
+
+    return "other";
+}
+
+MpegProbe::MpegProbe(FILE *fp, const Options *options) : mpeg_demux_t(fp, options)
+{
+}
+
+int MpegProbe::start(FILE *out)
+{
+    memset(_pack_type, 0, sizeof(_pack_type));
+    memset(_hits, 0, sizeof(_hits));
+    _ext = out;
+    return 0;
+}
+
+int MpegProbe::finish(int r)
+{
+    if (r == 0)
+        mpeg_probe_print(_ext);
+
+    close();
+    return r;
+}
+
+// the time budget ends a window at the pack past it
+int MpegProbe::pack()
+{
+    _pack_type[_pack.type < 3 ? _pack.type : 0] += 1;
+
+    if (_pack.type == 0)
+        return 0;
+
+    if (_win_pack == 0)
+    {
+        _win_scr = _pack.scr;
+        _win_pack = 1;
+    }
+
+    uint64_t t = (_pack.scr - _win_scr) & MPEG_SYNC_SCR_MASK;
+
+    // a jump back keeps the time read so far
+    if (t < _win_t || t - _win_t > MPEG_SYNC_SCR_MASK / 2)
+    {
+        _time += _win_t;
+        _win_scr = _pack.scr;
+        t = 0;
+    }
+
+    _win_t = t;
+
+    if (_win_time > 0 && t > _win_time)
+        _range_end = _ofs;
+
+    return 0;
+}
+
+// the parser counts the packets, only the windows are kept here
+int MpegProbe::packet()
+{
+    _seen[_packet.sid] = 1;
+
+    if (_packet.sid == 0xbd)
+        _seen[256 + _packet.ssid] = 1;
+
+    return 0;
+}
+
+int MpegProbe::mpeg_probe_window(uint64_t start, uint64_t end)
+{
+    memset(_seen, 0, sizeof(_seen));
+    _win_pack = 0;
+    _win_t = 0;
+    range(start, end, 1);
+
+    int r = parse(this);
+
+    // a window that ends before its budget ran into the end of the input
+    if (_win_cnt == 0 && _ofs < _range_end)
+        _complete = 1;
+
+    _read += _ofs - start;
+    _time += _win_t;
+    _win_cnt += 1;
+
+    for (unsigned i = 0; i < 512; i++)
+        _hits[i] += _seen[i];
+
+    return r;
+}
+
+int MpegProbe::probe(FILE *, FILE *out)
+{
+    if (start(out))
+        return 1;
+
+    uint64_t bytes = _options->probe_bytes();
+    unsigned cnt = _options->probe_windows();
+    int seekable = _seekable;
+    int r = 0;
+
+    // small inputs and those that can't seek are read from the start
+    if (seekable == 0 || bytes == 0 || bytes >= _size)
+        cnt = 1;
+
+    uint64_t share = bytes > 0 ? bytes / cnt : UINT64_MAX;
+    _win_time = _options->probe_time() / cnt;
+
+    for (unsigned i = 0; i < cnt && r == 0; i++)
+    {
+        uint64_t ofs = 0;
+
+        if (i > 0 && mpeg_sync_pack(fileno(_fp), _size / cnt * i, _size, &ofs))
+            break;
+
+        // windows don't overlap when the packs are far apart
+        if (i > 0 && ofs < _ofs)
+            ofs = _ofs;
+
+        // the input thread of the last window may have turned seeking off
+        _seekable = seekable;
+        r = mpeg_probe_window(ofs, share < UINT64_MAX - ofs ? ofs + share : UINT64_MAX);
+    }
+
+    return finish(r);
+}
+
+const char *MpegProbe::mpeg_probe_level(uint32_t packets, unsigned hits)
+{
+    if (_complete || (packets >= MPEG_PROBE_PACKETS && 2 * hits > _win_cnt))
+        return "high";
+
+    if (packets >= 2)
+        return "medium";
+
+    return "low";
+}
+
+void MpegProbe::mpeg_probe_print(FILE *fp)
+{
+    const char *flavor = "unknown";
+    const char *level = "low";
+    uint32_t packs = _pack_type[1] + _pack_type[2];
+
+    if (_pack_type[1] > 0 && _pack_type[2] > 0)
+        flavor = "mixed";
+    else if (_pack_type[1] > 0)
+        flavor = "MPEG-1";
+    else if (_pack_type[2] > 0)
+        flavor = "MPEG-2";
+
+    // mostly junk between the packs makes the flavor doubtful
+    if (_pack_type[1] == 0 || _pack_type[2] == 0)
+    {
+        if (packs >= 16 && 16 * uint64_t(_skip_cnt) < _read)
+            level = "high";
+        else if (packs >= 2)
+            level = "medium";
+    }
+
+    fprintf(fp,
+        "Windows:        %u\n"
+        "Read:           %" PRIuMAX " of %" PRIuMAX " bytes%s\n"
+        "Time:           %.4f s\n"
+        "Flavor:         %s / %s\n",
+        _win_cnt, uintmax_t(_read), uintmax_t(_size), _complete ? " / complete" : "",
+        double(_time) / 90000.0, flavor, packs > 0 ? level : "low");
+
+    for (unsigned i = 0; i < 256; i++)
+    {
+        if (streams[i].packet_cnt > 0)
+        {
+            fprintf(fp, "Stream %02x:      %s / %u packets / %u windows / %s\n",
+                i, mpeg_probe_kind(i), streams[i].packet_cnt, _hits[i],
+                mpeg_probe_level(streams[i].packet_cnt, _hits[i]));
+        }
+    }
+
+    for (unsigned i = 0; i < 256; i++)
+    {
+        if (substreams[i].packet_cnt > 0)
+        {
+            fprintf(fp, "Substream %02x:   %s / %u packets / %u windows / %s\n",
+                i, mpeg_probe_subkind(i), substreams[i].packet_cnt, _hits[256 + i],
+                mpeg_probe_level(substreams[i].packet_cnt, _hits[256 + i]));
+        }
+    }
+
+    fflush(fp);
+}
+
+
@@ -0,0 +1,42 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include "common.h"
+
+static constexpr unsigned MPEG_PROBE_PACKETS = 4;
+
+/*
+ * Stream inventory from a bounded read. A seekable input is read in
+ * windows spread evenly over the file, each with an equal share of the
+ * byte and time budget, other inputs from the start. A stream gets a
+ * higher confidence the more windows and packets it is seen in.
+ */
+class MpegProbe : public mpeg_demux_t
+{
+private:
+    unsigned _win_cnt = 0;
+    uint64_t _win_time = 0;
+    uint64_t _win_scr = 0;
+    uint64_t _win_t = 0;
+    int _win_pack = 0;
+    int _complete = 0;
+    uint64_t _read = 0;
+    uint64_t _time = 0;
+    uint32_t _pack_type[3];
+    unsigned _hits[512];
+    uint8_t _seen[512];
+    int mpeg_probe_window(uint64_t start, uint64_t end);
+    const char *mpeg_probe_level(uint32_t packets, unsigned hits);
+    void mpeg_probe_print(FILE *fp);
+public:
+    MpegProbe(FILE *fp, const Options *options);
+    int pack() override;
+    int packet() override;
+    int start(FILE *out) override;
+    int finish(int r) override;
+    int probe(FILE *inp, FILE *out);
+};
+
+#endif
+
+
@@ -0,0 +1,255 @@
+#include "range.h"
+#include "options.h"
+#include "parallel.h"
+#include "sync.h"
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+MpegRange::MpegRange(const Options *options) : _options(options)
+{
+}
+
+MpegRange::~MpegRange()
+{
+    for (unsigned i = 0; i < _cnt; i++)
+    {
+        _part[i]->unload();
+        delete _part[i];
+    }
+
+    free(_part);
+}
+
+mpeg_demux_t *MpegRange::mpeg_range_new(uint32_t mode, FILE *inp, const Options *opts)
+{
+    switch (mode)
+    {
+    case PAR_MODE_SCAN:
+        return new MpegScan(inp, opts);
+    case PAR_MODE_LIST:
+        return new MpegList(inp, opts);
+    case PAR_MODE_REMUX:
+        return new MpegRemux(inp, opts);
+    case PAR_MODE_DEMUX:
+        return new MpegDemux(inp, opts);
+    default:
+        return NULL;
+    }
+}
+
+int MpegRange::mpeg_range_mode(mpeg_demux_t *mpeg, uint32_t mode, FILE *inp, FILE *out)
+{
+    switch (mode)
+    {
+    case PAR_MODE_SCAN:
+        return ((MpegScan *)mpeg)->scan(inp, out);
+    case PAR_MODE_LIST:
+        return ((MpegList *)mpeg)->list(inp, out);
+    case PAR_MODE_REMUX:
+        return ((MpegRemux *)mpeg)->remux(inp, out);
+    case PAR_MODE_DEMUX:
+        return ((MpegDemux *)mpeg)->demux(inp, out);
+    default:
+        return 1;
+    }
+}
+
+// magic, version, mode, flags, start and stop, little endian
+int MpegRange::mpeg_range_put(FILE *out, const mpeg_part_t *part)
+{
+    uint8_t buf[MPEG_PART_HEADER];
+    uint64_t val[5] = { MPEG_PART_VERSION, part->mode, part->flags, part->start, part->stop };
+    unsigned size[5] = { 4, 4, 4, 8, 8 };
+    unsigned n = sizeof(MPEG_PART_MAGIC);
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, MPEG_PART_MAGIC, n);
+
+    for (unsigned i = 0; i < 5; i++)
+        for (unsigned j = 0; j < size[i]; j++)
+            buf[n++] = uint8_t(val[i] >> (8 * j));
+
+    return fwrite(buf, 1, sizeof(buf), out) != sizeof(buf);
+}
+
+// 1 at the end of the input, -1 on a bad header
+int MpegRange::mpeg_range_get(FILE *inp, mpeg_part_t *part)
+{
+    uint8_t buf[MPEG_PART_HEADER];
+    uint64_t val[5] = { 0, 0, 0, 0, 0 };
+    unsigned size[5] = { 4, 4, 4, 8, 8 };
+    unsigned n = sizeof(MPEG_PART_MAGIC);
+    size_t r = fread(buf, 1, sizeof(buf), inp);
+
+    if (r == 0)
+        return 1;
+
+    if (r != sizeof(buf) || memcmp(buf, MPEG_PART_MAGIC, n) != 0)
+        return -1;
+
+    for (unsigned i = 0; i < 5; i++)
+        for (unsigned j = 0; j < size[i]; j++)
+            val[i] |= uint64_t(buf[n++]) << (8 * j);
+
+    if (val[0] != MPEG_PART_VERSION)
+        return -1;
+
+    part->mode = uint32_t(val[1]);
+    part->flags = uint32_t(val[2]);
+    part->start = val[3];
+    part->stop = val[4];
+    return 0;
+}
+
+int MpegRange::run(FILE *inp, FILE *out)
+{
+    struct stat st;
+
+    if (MpegParallel::mergeable(_options) == 0)
+    {
+        fprintf(stderr, "range: mode not supported\n");
+        return 1;
+    }
+
+    if (fstat(fileno(inp), &st) || !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "range: input must be a file\n");
+        return 1;
+    }
+
+    // every run finds the same pack for the same offset, so ranges join
+    uint64_t size = uint64_t(st.st_size);
+    mpeg_part_t part;
+    part.mode = _options->_par_mode;
+    part.flags = 0;
+    part.start = _options->range_start();
+    uint64_t end = _options->range_end();
+
+    if (part.start > 0 && mpeg_sync_pack(fileno(inp), part.start, size, &part.start))
+        part.start = size;
+
+    if (end >= size || mpeg_sync_pack(fileno(inp), end, size, &end))
+    {
+        end = UINT64_MAX;
+        part.flags |= MPEG_PART_LAST;
+    }
+
+    FILE *tmp = tmpfile();
+
+    if (tmp == NULL)
+        return 1;
+
+    mpeg_demux_t *mpeg = mpeg_range_new(part.mode, inp, _options);
+    mpeg->range(part.start, end, 1);
+    int r = mpeg_range_mode(mpeg, part.mode, inp, tmp);
+    part.stop = mpeg->_ofs;
+
+    // save() reads the main output back, unload() closes it
+    if (r == 0 && (mpeg_range_put(out, &part) || mpeg->save(out)))
+        r = 1;
+
+    mpeg->unload();
+    delete mpeg;
+    return r;
+}
+
+int MpegRange::mpeg_range_merge(uint32_t mode, FILE *out)
+{
+    switch (mode)
+    {
+    case PAR_MODE_SCAN:
+    {
+        MpegScan mpeg(NULL, _options);
+        return mpeg.scan_merge((MpegScan **)_part, _cnt, out);
+    }
+    case PAR_MODE_LIST:
+    {
+        MpegList mpeg(NULL, _options);
+        return mpeg.list_merge((MpegList **)_part, _cnt, out);
+    }
+    case PAR_MODE_REMUX:
+    {
+        MpegRemux mpeg(NULL, _options);
+        return mpeg.remux_merge((MpegRemux **)_part, _cnt, out);
+    }
+    case PAR_MODE_DEMUX:
+    {
+        MpegDemux mpeg(NULL, _options);
+        return mpeg.demux_merge((MpegDemux **)_part, _cnt, out);
+    }
+    default:
+        return 1;
+    }
+}
+
+int MpegRange::merge(FILE *inp, FILE *out)
+{
+    mpeg_part_t part;
+    mpeg_part_t prev = { 0, 0, 0, 0 };
+    unsigned max = 0;
+    int r;
+
+    while ((r = mpeg_range_get(inp, &part)) == 0)
+    {
+        if (_cnt > 0 && part.mode != prev.mode)
+        {
+            fprintf(stderr, "merge: parts are from different modes\n");
+            return 1;
+        }
+
+        // a false pack start or an error would leave a gap or an overlap
+        if (part.start != prev.stop || (_cnt > 0 && (prev.flags & MPEG_PART_LAST)))
+        {
+            fprintf(stderr, "merge: parts don't join (%08" PRIxMAX "/%08" PRIxMAX ")\n",
+                uintmax_t(prev.stop), uintmax_t(part.start));
+
+            return 1;
+        }
+
+        if (_cnt >= max)
+        {
+            max = max > 0 ? 2 * max : 16;
+            mpeg_demux_t **tmp = (mpeg_demux_t **)realloc(_part, max * sizeof(mpeg_demux_t *));
+
+            if (tmp == NULL)
+                return 1;
+
+            _part = tmp;
+        }
+
+        mpeg_demux_t *mpeg = mpeg_range_new(part.mode, NULL, _options);
+
+        if (mpeg == NULL)
+        {
+            fprintf(stderr, "merge: mode not supported\n");
+            return 1;
+        }
+
+        _part[_cnt++] = mpeg;
+
+        if (mpeg->load(inp))
+        {
+            fprintf(stderr, "merge: bad part (%u)\n", _cnt - 1);
+            return 1;
+        }
+
+        prev = part;
+    }
+
+    if (r < 0)
+    {
+        fprintf(stderr, "merge: bad part header (%u)\n", _cnt);
+        return 1;
+    }
+
+    if (_cnt == 0 || (prev.flags & MPEG_PART_LAST) == 0)
+    {
+        fprintf(stderr, "merge: last part missing\n");
+        return 1;
+    }
+
+    return mpeg_range_merge(prev.mode, out);
+}
+
+
@@ -0,0 +1,46 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include "common.h"
+
+static constexpr char MPEG_PART_MAGIC[8] = { 'M', 'P', 'G', 'P', 'A', 'R', 'T', 0 };
+static constexpr uint32_t MPEG_PART_VERSION = 1;
+static constexpr unsigned MPEG_PART_HEADER = 40;
+static constexpr uint32_t MPEG_PART_LAST = 0x01;
+
+struct mpeg_part_t
+{
+    uint32_t mode;
+    uint32_t flags;
+    uint64_t start;
+    uint64_t stop;
+};
+
+/*
+ * Byte range runs, to spread one input over several machines. A run
+ * parses the packs that start in [start, end), with both ends moved to
+ * the next pack, and writes a partial result. The merge reads the
+ * partial results in input order, concatenated into one stream, and
+ * writes what a single run over the whole input would have written.
+ */
+class MpegRange
+{
+private:
+    const Options *_options;
+    mpeg_demux_t **_part = nullptr;
+    unsigned _cnt = 0;
+    static mpeg_demux_t *mpeg_range_new(uint32_t mode, FILE *inp, const Options *opts);
+    static int mpeg_range_mode(mpeg_demux_t *mpeg, uint32_t mode, FILE *inp, FILE *out);
+    int mpeg_range_put(FILE *out, const mpeg_part_t *part);
+    int mpeg_range_get(FILE *inp, mpeg_part_t *part);
+    int mpeg_range_merge(uint32_t mode, FILE *out);
+public:
+    MpegRange(const Options *options);
+    ~MpegRange();
+    int run(FILE *inp, FILE *out);
+    int merge(FILE *inp, FILE *out);
+};
+
+#endif
+
+
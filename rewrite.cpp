@@ -0,0 +1,273 @@
+#include "rewrite.h"
+#include "options.h"
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+MpegRewrite::MpegRewrite(FILE *fp, const Options *options) : mpeg_demux_t(fp, options)
+{
+}
+
+MpegRewrite::~MpegRewrite()
+{
+    free(_journal_name);
+}
+
+int MpegRewrite::mpeg_rewrite_journal(const char *inp)
+{
+    const char *name = _options->_journal_name;
+
+    if (name == NULL)
+    {
+        // default to a journal next to the input file
+        _journal_name = (char *)malloc(strlen(inp) + 9);
+
+        if (_journal_name == NULL)
+            return 1;
+
+        strcpy(_journal_name, inp);
+        strcat(_journal_name, ".journal");
+    }
+    else
+    {
+        _journal_name = (char *)malloc(strlen(name) + 1);
+
+        if (_journal_name == NULL)
+            return 1;
+
+        strcpy(_journal_name, name);
+    }
+
+    return 0;
+}
+
+int MpegRewrite::mpeg_rewrite_byte(uint64_t ofs, uint8_t old, uint8_t val)
+{
+    if (_options->dry_run())
+    {
+        fprintf(_ext, "%08" PRIxMAX ": %02x -> %02x\n", uintmax_t(ofs), old, val);
+        _rewrite_cnt += 1;
+        return 0;
+    }
+
+    _batch_ofs[_batch_cnt] = ofs;
+    _batch_old[_batch_cnt] = old;
+    _batch_new[_batch_cnt] = val;
+    _batch_cnt += 1;
+
+    if (_batch_cnt >= MPEG_REWRITE_BATCH)
+        return mpeg_rewrite_flush();
+
+    return 0;
+}
+
+// journal a batch of changes, then apply it
+int MpegRewrite::mpeg_rewrite_flush()
+{
+    if (_batch_cnt == 0)
+        return 0;
+
+    for (unsigned i = 0; i < _batch_cnt; i++)
+    {
+        fprintf(_journal, "%016" PRIxMAX " %02x %02x\n",
+            uintmax_t(_batch_ofs[i]), _batch_old[i], _batch_new[i]);
+    }
+
+    if (fflush(_journal) || fdatasync(fileno(_journal)))
+    {
+        fprintf(stderr, "rewrite: can't write journal (%s)\n", _journal_name);
+        return 1;
+    }
+
+    for (unsigned i = 0; i < _batch_cnt; i++)
+    {
+        if (pwrite(_fd, &_batch_new[i], 1, off_t(_batch_ofs[i])) != 1)
+        {
+            fprintf(stderr, "rewrite: write error at %08" PRIxMAX "\n",
+                uintmax_t(_batch_ofs[i]));
+
+            return 1;
+        }
+    }
+
+    _rewrite_cnt += _batch_cnt;
+    _batch_cnt = 0;
+    return 0;
+}
+
+int MpegRewrite::packet()
+{
+    uint32_t sid = _packet.sid;
+    uint32_t ssid = _packet.ssid;
+
+    if (mpeg_stream_excl(sid, ssid))
+        return 0;
+
+    if (_options->_par_stream_map[sid] != sid)
+        if (mpeg_rewrite_byte(_ofs + 3, sid, _options->_par_stream_map[sid]))
+            return 1;
+
+    if (sid == 0xbd && _packet.offset < _packet.size)
+    {
+        if (_options->_par_substream_map[ssid] != ssid)
+        {
+            if (mpeg_rewrite_byte(_ofs + _packet.offset, ssid,
+                _options->_par_substream_map[ssid]))
+            {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int MpegRewrite::rewrite(FILE *inp, FILE *out)
+{
+    const char *name = _options->_inp_name;
+
+    if (name == NULL || _seekable == 0)
+    {
+        fprintf(stderr, "rewrite: input must be a named, seekable file\n");
+        return 1;
+    }
+
+    _ext = out;
+
+    if (_options->dry_run() == 0)
+    {
+        if (mpeg_rewrite_journal(name))
+            return 1;
+
+        if (access(_journal_name, F_OK) == 0)
+        {
+            fprintf(stderr, "rewrite: journal exists, roll back first (%s)\n",
+                _journal_name);
+
+            return 1;
+        }
+
+        _fd = open(name, O_RDWR);
+
+        if (_fd < 0)
+        {
+            fprintf(stderr, "rewrite: can't open input for writing (%s)\n", name);
+            return 1;
+        }
+
+        _journal = fopen(_journal_name, "w");
+
+        if (_journal == NULL)
+        {
+            fprintf(stderr, "rewrite: can't create journal (%s)\n", _journal_name);
+            ::close(_fd);
+            return 1;
+        }
+    }
+
+    int r = parse(this);
+
+    if (_options->dry_run() == 0)
+    {
+        if (mpeg_rewrite_flush())
+            r = 1;
+
+        if (fdatasync(_fd))
+            r = 1;
+
+        ::close(_fd);
+        fclose(_journal);
+
+        // the journal is only needed until the changes are on disk
+        if (r == 0)
+            unlink(_journal_name);
+    }
+
+    fprintf(_ext, "%s %" PRIuMAX " bytes\n",
+        _options->dry_run() ? "Would rewrite:" : "Rewritten:",
+        uintmax_t(_rewrite_cnt));
+
+    close();
+    return r;
+}
+
+int MpegRewrite::rollback(FILE *out)
+{
+    const char *name = _options->_inp_name;
+
+    if (name == NULL)
+    {
+        fprintf(stderr, "rollback: input must be a named file\n");
+        return 1;
+    }
+
+    if (mpeg_rewrite_journal(name))
+        return 1;
+
+    _journal = fopen(_journal_name, "r");
+
+    if (_journal == NULL)
+    {
+        fprintf(stderr, "rollback: can't open journal (%s)\n", _journal_name);
+        return 1;
+    }
+
+    _fd = open(name, O_RDWR);
+
+    if (_fd < 0)
+    {
+        fprintf(stderr, "rollback: can't open input for writing (%s)\n", name);
+        fclose(_journal);
+        return 1;
+    }
+
+    int r = 0;
+    uintmax_t ofs;
+    unsigned old, val;
+
+    // a torn last line was never applied and ends the loop
+    while (fscanf(_journal, "%" SCNxMAX " %x %x\n", &ofs, &old, &val) == 3)
+    {
+        uint8_t cur;
+
+        if (pread(_fd, &cur, 1, off_t(ofs)) != 1)
+        {
+            r = 1;
+            break;
+        }
+
+        if (cur != val && cur != old)
+        {
+            fprintf(stderr, "rollback: unexpected byte at %08" PRIxMAX
+                " (%02x)\n", ofs, cur);
+
+            r = 1;
+            continue;
+        }
+
+        cur = uint8_t(old);
+
+        if (pwrite(_fd, &cur, 1, off_t(ofs)) != 1)
+        {
+            r = 1;
+            break;
+        }
+
+        _rewrite_cnt += 1;
+    }
+
+    if (fdatasync(_fd))
+        r = 1;
+
+    ::close(_fd);
+    fclose(_journal);
+
+    if (r == 0)
+        unlink(_journal_name);
+
+    fprintf(out, "Rolled back: %" PRIuMAX " bytes\n", uintmax_t(_rewrite_cnt));
+    return r;
+}
+
+
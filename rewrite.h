@@ -0,0 +1,32 @@
+#ifndef REWRITE_H
+#define REWRITE_H
+
+#include "common.h"
+
+static constexpr unsigned MPEG_REWRITE_BATCH = 256;
+
+class MpegRewrite : public mpeg_demux_t
+{
+private:
+    int _fd = -1;
+    FILE *_journal = nullptr;
+    char *_journal_name = nullptr;
+    uint64_t _rewrite_cnt = 0;
+    unsigned _batch_cnt = 0;
+    uint64_t _batch_ofs[MPEG_REWRITE_BATCH];
+    uint8_t _batch_old[MPEG_REWRITE_BATCH];
+    uint8_t _batch_new[MPEG_REWRITE_BATCH];
+    int mpeg_rewrite_byte(uint64_t ofs, uint8_t old, uint8_t val);
+    int mpeg_rewrite_flush();
+    int mpeg_rewrite_journal(const char *inp);
+public:
+    MpegRewrite(FILE *fp, const Options *options);
+    ~MpegRewrite();
+    int packet() override;
+    int rewrite(FILE *inp, FILE *out);
+    int rollback(FILE *out);
+};
+
+#endif
+
+
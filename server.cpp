@@ -0,0 +1,366 @@
+#include "server.h"
+#include "job.h"
+#include "pool.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int mpeg_server_fd = -1;
+static volatile sig_atomic_t mpeg_server_stop = 0;
+
+// wakes up the workers blocked in accept()
+static void mpeg_server_signal(int)
+{
+    mpeg_server_stop = 1;
+
+    if (mpeg_server_fd >= 0)
+        shutdown(mpeg_server_fd, SHUT_RDWR);
+}
+
+static int mpeg_socket_addr(struct sockaddr_un *addr, const char *name)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(name) >= sizeof(addr->sun_path))
+        return 1;
+
+    strcpy(addr->sun_path, name);
+    return 0;
+}
+
+static int mpeg_socket_send(int fd, const void *buf, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    while (n > 0)
+    {
+        ssize_t r = send(fd, p, n, MSG_NOSIGNAL);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+
+        if (r <= 0)
+            return 1;
+
+        p += r;
+        n -= size_t(r);
+    }
+
+    return 0;
+}
+
+// name relative to the client's directory, NULL if it is used as is
+static char *mpeg_server_path(const char *cwd, const char *name)
+{
+    if (name == NULL || name[0] == '/' || strcmp(name, "-") == 0)
+        return NULL;
+
+    size_t n = strlen(cwd) + strlen(name) + 2;
+    char *ret = (char *)malloc(n);
+
+    if (ret != NULL)
+        snprintf(ret, n, "%s/%s", cwd, name);
+
+    return ret;
+}
+
+MpegServer::MpegServer(const Options *options, const char *prog) : _options(options), _prog(prog)
+{
+}
+
+MpegServer::~MpegServer()
+{
+    if (_fd >= 0)
+        close(_fd);
+}
+
+int MpegServer::mpeg_server_job(int fd, mpeg_buffer_t *req, FILE *log)
+{
+    uint8_t tmp[4096];
+    ssize_t n;
+    req->clear();
+
+    // the client shuts down its side after the request
+    while ((n = read(fd, tmp, sizeof(tmp))) != 0)
+    {
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0 || req->cnt + n > MPEG_SERVER_REQUEST_MAX)
+            return 1;
+
+        if (req->append(tmp, unsigned(n)))
+            return 1;
+    }
+
+    if (req->append("", 1))
+        return 1;
+
+    char *cwd = (char *)req->buf;
+    char *line = strchr(cwd, '\n');
+
+    if (line == NULL || cwd[0] != '/')
+    {
+        fprintf(stderr, "server: bad request\n");
+        return 1;
+    }
+
+    *line++ = 0;
+    int argc;
+    char **argv;
+
+    if (Options::tokenize(line, _prog, &argc, &argv))
+        return 1;
+
+    Options opts(*_options);
+    int r = 1;
+    char *inp = NULL;
+    char *out = NULL;
+
+    if (opts.parse(argc, argv))
+    {
+        free(argv);
+        return 1;
+    }
+
+    if (opts._arg_inp == NULL || strcmp(opts._arg_inp, "-") == 0
+        || opts._batch_name != NULL || opts._listen_name != NULL)
+    {
+        fprintf(stderr, "server: bad job (%s)\n", line);
+        free(argv);
+        return 1;
+    }
+
+    inp = mpeg_server_path(cwd, opts._arg_inp);
+    out = mpeg_server_path(cwd, opts._arg_out);
+
+    if (inp != NULL)
+        opts._arg_inp = inp;
+
+    if (out != NULL)
+        opts._arg_out = out;
+
+    char *name = mpeg_server_path(cwd, opts._demux_name);
+
+    if (name != NULL)
+    {
+        free(opts._demux_name);
+        opts._demux_name = name;
+    }
+
+    name = mpeg_server_path(cwd, opts._journal_name);
+
+    if (name != NULL)
+    {
+        free(opts._journal_name);
+        opts._journal_name = name;
+    }
+
+    if (opts.open(_prog) == 0)
+    {
+        // standard output goes back to the client
+        if (opts._par_out == stdout)
+            opts._par_out = log;
+
+        r = mpeg_job_run(&opts);
+    }
+
+    if (opts._par_inp != NULL && opts._par_inp != stdin)
+        fclose(opts._par_inp);
+
+    if (opts._par_out != NULL && opts._par_out != log && opts._par_out != stdout)
+        if (fclose(opts._par_out))
+            r = 1;
+
+    free(inp);
+    free(out);
+    free(argv);
+    return r;
+}
+
+void MpegServer::mpeg_server_loop()
+{
+    mpeg_buffer_t req;
+    FILE *log = tmpfile();
+
+    if (log == NULL)
+    {
+        fprintf(stderr, "server: can't create output file\n");
+        return;
+    }
+
+    while (mpeg_server_stop == 0)
+    {
+        int fd = accept(_fd, NULL, NULL);
+
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            break;
+        }
+
+        int r = mpeg_server_job(fd, &req, log);
+        char buf[4096];
+        size_t n = size_t(snprintf(buf, sizeof(buf), "%d\n", r));
+        fflush(log);
+        rewind(log);
+
+        if (mpeg_socket_send(fd, buf, n) == 0)
+        {
+            while ((n = fread(buf, 1, sizeof(buf), log)) > 0)
+                if (mpeg_socket_send(fd, buf, n))
+                    break;
+        }
+
+        close(fd);
+
+        // the file is reused by the next job
+        rewind(log);
+
+        if (ftruncate(fileno(log), 0))
+            break;
+    }
+
+    req.free();
+    fclose(log);
+}
+
+void MpegServer::mpeg_server_worker(void *ctx, unsigned)
+{
+    ((MpegServer *)ctx)->mpeg_server_loop();
+}
+
+int MpegServer::run()
+{
+    const char *name = _options->_listen_name;
+    struct sockaddr_un addr;
+
+    if (mpeg_socket_addr(&addr, name))
+    {
+        fprintf(stderr, "server: socket name too long (%s)\n", name);
+        return 1;
+    }
+
+    _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (_fd < 0)
+        return 1;
+
+    // a socket left behind by an earlier server
+    unlink(name);
+
+    if (bind(_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(_fd, 64))
+    {
+        fprintf(stderr, "server: can't listen on socket (%s)\n", name);
+        return 1;
+    }
+
+    mpeg_server_fd = _fd;
+    signal(SIGINT, mpeg_server_signal);
+    signal(SIGTERM, mpeg_server_signal);
+
+    mpeg_pool_t pool;
+    unsigned threads = _options->jobs() > 0 ? _options->jobs() : mpeg_pool_t::cores();
+    pool.run(threads, threads, mpeg_server_worker, this);
+
+    mpeg_server_fd = -1;
+    unlink(name);
+    return 0;
+}
+
+MpegClient::MpegClient(const char *name) : _name(name)
+{
+}
+
+int MpegClient::run(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    mpeg_buffer_t req;
+    char cwd[4096];
+
+    if (mpeg_socket_addr(&addr, _name))
+    {
+        fprintf(stderr, "client: socket name too long (%s)\n", _name);
+        return 1;
+    }
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+        return 1;
+
+    // every word in quotes, the server splits it like a manifest line
+    int r = req.append(cwd, unsigned(strlen(cwd))) || req.append("\n", 1);
+
+    for (int i = 1; i < argc && r == 0; i++)
+    {
+        if (strchr(argv[i], '"') != NULL || strchr(argv[i], '\n') != NULL)
+        {
+            fprintf(stderr, "client: can't pass argument (%s)\n", argv[i]);
+            r = 1;
+            break;
+        }
+
+        r = req.append(" \"", 2) || req.append(argv[i], unsigned(strlen(argv[i])))
+            || req.append("\"", 1);
+    }
+
+    if (r || req.append("\n", 1))
+    {
+        req.free();
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        fprintf(stderr, "client: can't connect to server (%s)\n", _name);
+
+        if (fd >= 0)
+            close(fd);
+
+        req.free();
+        return 1;
+    }
+
+    r = mpeg_socket_send(fd, req.buf, req.cnt);
+    req.free();
+    shutdown(fd, SHUT_WR);
+
+    // exit status line, then the job's output
+    FILE *fp = r == 0 ? fdopen(fd, "rb") : NULL;
+
+    if (fp == NULL)
+    {
+        close(fd);
+        return 1;
+    }
+
+    char buf[4096];
+    size_t n;
+
+    if (fgets(buf, sizeof(buf), fp) == NULL)
+    {
+        fprintf(stderr, "client: no reply from server (%s)\n", _name);
+        fclose(fp);
+        return 1;
+    }
+
+    r = atoi(buf);
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        if (fwrite(buf, 1, n, stdout) != n)
+            r = 1;
+
+    fclose(fp);
+    fflush(stdout);
+    return r;
+}
+
+
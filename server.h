@@ -0,0 +1,45 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <inttypes.h>
+#include <cstdio>
+#include "options.h"
+#include "buffer.h"
+
+static constexpr unsigned MPEG_SERVER_REQUEST_MAX = 65536;
+
+/*
+ * Job server on a UNIX socket. A request is the client's working
+ * directory on one line and its command line on the next, the reply
+ * is the exit status on one line followed by the job's standard
+ * output. Every worker thread accepts and runs jobs on its own and
+ * keeps its buffers from one job to the next.
+ */
+class MpegServer
+{
+private:
+    const Options *_options;
+    const char *_prog;
+    int _fd = -1;
+    int mpeg_server_job(int fd, mpeg_buffer_t *req, FILE *log);
+    void mpeg_server_loop();
+    static void mpeg_server_worker(void *ctx, unsigned i);
+public:
+    MpegServer(const Options *options, const char *prog);
+    ~MpegServer();
+    int run();
+};
+
+// sends the command line to a server and prints its reply
+class MpegClient
+{
+private:
+    const char *_name;
+public:
+    MpegClient(const char *name);
+    int run(int argc, char **argv);
+};
+
+#endif
+
+
@@ -0,0 +1,349 @@
+#include "sync.h"
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+/*
+ * Return the index of the first 00 00 01 prefix in buf, or n if there
+ * is none. memchr does the scanning for the 01 byte, which is where
+ * the vectorized code in the C library takes over.
+ */
+unsigned mpeg_find_start(const uint8_t *buf, unsigned n)
+{
+    unsigned i = 2;
+
+    while (i < n)
+    {
+        const uint8_t *p = (const uint8_t *)memchr(buf + i, 0x01, n - i);
+
+        if (p == NULL)
+            return n;
+
+        i = unsigned(p - buf);
+
+        if (buf[i - 1] == 0 && buf[i - 2] == 0)
+            return i - 2;
+
+        i += buf[i - 1] == 0 ? 1 : 3;
+    }
+
+    return n;
+}
+
+// size of the pack header at buf, or 0 if it isn't one
+static unsigned mpeg_sync_pack_size(const uint8_t *buf, unsigned n)
+{
+    if (n < 14)
+        return 0;
+
+    // check the marker bits as well, the start code alone is too weak
+    if ((buf[4] & 0xf1) == 0x21)
+    {
+        if ((buf[6] & buf[8] & 0x01) && (buf[9] & 0x80) && (buf[11] & 0x01))
+            return 12;
+    }
+    else if ((buf[4] & 0xc4) == 0x44)
+    {
+        if ((buf[6] & buf[8] & 0x04) && (buf[9] & 0x01) && (buf[12] & 0x03) == 0x03)
+            return 14 + (buf[13] & 7);
+    }
+
+    return 0;
+}
+
+/*
+ * Check that a pack starts at buf[0] by following the pack header and
+ * the packet lengths until the next pack, end code or end of buffer.
+ */
+static int mpeg_sync_check(const uint8_t *buf, unsigned n)
+{
+    unsigned i = mpeg_sync_pack_size(buf, n);
+
+    if (i == 0)
+        return 1;
+
+    while (i + 6 <= n)
+    {
+        if (buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 1)
+            return 1;
+
+        if (buf[i + 3] == 0xba || buf[i + 3] == 0xb9)
+            return 0;
+
+        if (buf[i + 3] < 0xbb)
+            return 1;
+
+        i += 6 + ((unsigned(buf[i + 4]) << 8) | buf[i + 5]);
+    }
+
+    // ran into the end of the buffer without a contradiction
+    return 0;
+}
+
+/*
+ * Find the first pack at or after ofs and before end, reading the file
+ * with pread only. Returns 1 if there is none.
+ */
+int mpeg_sync_pack(int fd, uint64_t ofs, uint64_t end, uint64_t *ret)
+{
+    uint8_t *buf = (uint8_t *)malloc(2 * MPEG_SYNC_WINDOW);
+
+    if (buf == NULL)
+        return 1;
+
+    while (ofs < end)
+    {
+        ssize_t n = pread(fd, buf, 2 * MPEG_SYNC_WINDOW, off_t(ofs));
+
+        if (n < 4)
+            break;
+
+        int eof = n < ssize_t(2 * MPEG_SYNC_WINDOW);
+        unsigned lim = eof ? unsigned(n) : MPEG_SYNC_WINDOW;
+        unsigned i = 0;
+
+        while (i < lim && ofs + i < end)
+        {
+            i += mpeg_find_start(buf + i, unsigned(n) - i);
+
+            if (i + 3 >= unsigned(n) || i >= lim || ofs + i >= end)
+                break;
+
+            if (buf[i + 3] == 0xba)
+            {
+                if (mpeg_sync_check(buf + i, unsigned(n) - i) == 0)
+                {
+                    *ret = ofs + i;
+                    free(buf);
+                    return 0;
+                }
+            }
+
+            i += 1;
+        }
+
+        if (eof)
+            break;
+
+        ofs += MPEG_SYNC_WINDOW;
+    }
+
+    free(buf);
+    return 1;
+}
+
+// SCR of a pack header that mpeg_sync_pack_size() accepted
+static uint64_t mpeg_sync_scr(const uint8_t *buf)
+{
+    if ((buf[4] & 0xf1) == 0x21)
+    {
+        return uint64_t((buf[4] >> 1) & 7) << 30 | uint64_t(buf[5]) << 22
+            | uint64_t(buf[6] >> 1) << 15 | uint64_t(buf[7]) << 7 | (buf[8] >> 1);
+    }
+
+    return uint64_t((buf[4] >> 3) & 7) << 30 | uint64_t(buf[4] & 3) << 28
+        | uint64_t(buf[5]) << 20 | uint64_t(buf[6] >> 3) << 15 | uint64_t(buf[6] & 3) << 13
+        | uint64_t(buf[7]) << 5 | (buf[8] >> 3);
+}
+
+// mux rate in units of 50 bytes per second
+static uint32_t mpeg_sync_mux(const uint8_t *buf)
+{
+    if ((buf[4] & 0xf1) == 0x21)
+        return uint32_t(buf[9] & 0x7f) << 15 | uint32_t(buf[10]) << 7 | (buf[11] >> 1);
+
+    return uint32_t(buf[10]) << 14 | uint32_t(buf[11]) << 6 | (buf[12] >> 2);
+}
+
+static int mpeg_sync_scr_at(int fd, uint64_t ofs, uint64_t *scr, uint32_t *mux)
+{
+    uint8_t buf[32];
+    ssize_t n = pread(fd, buf, sizeof(buf), off_t(ofs));
+
+    if (n < 14 || mpeg_sync_pack_size(buf, unsigned(n)) == 0)
+        return 1;
+
+    *scr = mpeg_sync_scr(buf);
+    *mux = mpeg_sync_mux(buf);
+    return 0;
+}
+
+/*
+ * Walk the packs from lo, whose time is t, up to and including the
+ * pack at hi. Returns the last pack at or before the time in *ret, or
+ * 2 with the pack after a backward SCR jump in *ret and the time
+ * before the jump in *t.
+ */
+static int mpeg_sync_walk(int fd, uint64_t lo, uint64_t hi, uint64_t base, uint64_t time,
+    uint64_t *ret, uint64_t *t)
+{
+    uint8_t *buf = (uint8_t *)malloc(2 * MPEG_SYNC_WINDOW);
+    uint64_t ofs = lo;
+    *ret = lo;
+
+    if (buf == NULL)
+        return 1;
+
+    while (ofs <= hi)
+    {
+        ssize_t n = pread(fd, buf, 2 * MPEG_SYNC_WINDOW, off_t(ofs));
+
+        if (n < 14)
+            break;
+
+        int eof = n < ssize_t(2 * MPEG_SYNC_WINDOW);
+        unsigned lim = eof ? unsigned(n) : MPEG_SYNC_WINDOW;
+        unsigned i = 0;
+
+        while (i < lim && ofs + i <= hi)
+        {
+            i += mpeg_find_start(buf + i, unsigned(n) - i);
+
+            if (i + 14 > unsigned(n) || i >= lim || ofs + i > hi)
+                break;
+
+            if (buf[i + 3] == 0xba && mpeg_sync_check(buf + i, unsigned(n) - i) == 0)
+            {
+                uint64_t cur = (mpeg_sync_scr(buf + i) - base) & MPEG_SYNC_SCR_MASK;
+
+                if (cur < *t || cur - *t > MPEG_SYNC_SCR_MASK / 2)
+                {
+                    *ret = ofs + i;
+                    free(buf);
+                    return 2;
+                }
+
+                if (cur > time)
+                {
+                    free(buf);
+                    return 0;
+                }
+
+                *ret = ofs + i;
+                *t = cur;
+            }
+
+            i += 1;
+        }
+
+        if (eof)
+            break;
+
+        ofs += MPEG_SYNC_WINDOW;
+    }
+
+    free(buf);
+    return 0;
+}
+
+/*
+ * Find the last pack at or before a time, in 90 kHz ticks from the
+ * first pack. Times are SCR differences modulo 2^33, so wraparound is
+ * harmless. The offsets are bisected on SCR samples and the last step
+ * is a walk over the packs in between, which checks the result.
+ *
+ * A sample that is earlier than the low end, or that would need the
+ * bytes in between to arrive faster than twice the mux rate, is behind
+ * a backward SCR jump. The walk finds such a jump and the time that is
+ * left is looked for after it, so jumps count as no time. Jumps that
+ * no sample lands behind can't be seen this way. The clock is set for
+ * the pack found. Returns 1 if the input has no packs.
+ */
+int mpeg_sync_time(int fd, uint64_t size, uint64_t time, uint64_t *ret, mpeg_clock_t *clk)
+{
+    uint64_t lo, base;
+    uint64_t acc = 0;
+    uint32_t mux;
+
+    if (mpeg_sync_pack(fd, 0, size, &lo) || mpeg_sync_scr_at(fd, lo, &base, &mux))
+        return 1;
+
+    while (true)
+    {
+        uint64_t lo_t = 0;
+        uint32_t lo_mux = mux;
+        uint64_t hi = size;
+
+        while (hi - lo > 2 * MPEG_SYNC_WINDOW)
+        {
+            uint64_t mid = lo + (hi - lo) / 2;
+            uint64_t ofs, scr;
+
+            if (mpeg_sync_pack(fd, mid, hi, &ofs) || mpeg_sync_scr_at(fd, ofs, &scr, &mux))
+            {
+                hi = mid;
+                continue;
+            }
+
+            uint64_t t = (scr - base) & MPEG_SYNC_SCR_MASK;
+            uint64_t min = lo_mux > 0 ? (ofs - lo) * 900 / lo_mux : 0;
+
+            if (t >= lo_t && t - lo_t >= min && t <= time)
+            {
+                lo = ofs;
+                lo_t = t;
+                lo_mux = mux;
+            }
+            else
+            {
+                hi = ofs;
+            }
+        }
+
+        int r = mpeg_sync_walk(fd, lo, hi, base, time, ret, &lo_t);
+
+        if (r != 2)
+        {
+            clk->base = base;
+            clk->acc = acc;
+            clk->t = lo_t;
+            return r;
+        }
+
+        time -= lo_t;
+        acc += lo_t;
+        lo = *ret;
+
+        if (mpeg_sync_scr_at(fd, lo, &base, &mux))
+            return 1;
+    }
+}
+
+void mpeg_clock_init(mpeg_clock_t *clk, uint64_t scr)
+{
+    clk->base = scr;
+    clk->acc = 0;
+    clk->t = 0;
+}
+
+// time of a pack, a step of more than half the range is a jump back
+uint64_t mpeg_clock_pack(mpeg_clock_t *clk, uint64_t scr)
+{
+    uint64_t t = (scr - clk->base) & MPEG_SYNC_SCR_MASK;
+
+    if (t < clk->t || t - clk->t > MPEG_SYNC_SCR_MASK / 2)
+    {
+        clk->acc += clk->t;
+        clk->base = scr;
+        t = 0;
+    }
+
+    clk->t = t;
+    return clk->acc + t;
+}
+
+// a time stamp a little before the base is early, not 2^33 ticks late
+uint64_t mpeg_clock_time(const mpeg_clock_t *clk, uint64_t pts)
+{
+    uint64_t t = (pts - clk->base) & MPEG_SYNC_SCR_MASK;
+
+    if (t > MPEG_SYNC_SCR_MASK / 2)
+    {
+        t = MPEG_SYNC_SCR_MASK + 1 - t;
+        return t < clk->acc ? clk->acc - t : 0;
+    }
+
+    return clk->acc + t;
+}
+
+
@@ -0,0 +1,31 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <inttypes.h>
+#include <cstdio>
+
+static constexpr unsigned MPEG_SYNC_WINDOW = 65536;
+static constexpr uint64_t MPEG_SYNC_SCR_MASK = 0x1ffffffffULL;
+
+/*
+ * Time from the first pack. SCR and PTS are taken modulo 2^33 from the
+ * base, the SCR that starts the current stretch. A backward SCR jump
+ * starts a new stretch, the time before it goes to acc.
+ */
+struct mpeg_clock_t
+{
+    uint64_t base;
+    uint64_t acc;
+    uint64_t t;
+};
+
+unsigned mpeg_find_start(const uint8_t *buf, unsigned n);
+int mpeg_sync_pack(int fd, uint64_t ofs, uint64_t end, uint64_t *ret);
+int mpeg_sync_time(int fd, uint64_t size, uint64_t time, uint64_t *ret, mpeg_clock_t *clk);
+void mpeg_clock_init(mpeg_clock_t *clk, uint64_t scr);
+uint64_t mpeg_clock_pack(mpeg_clock_t *clk, uint64_t scr);
+uint64_t mpeg_clock_time(const mpeg_clock_t *clk, uint64_t pts);
+
+#endif
+
+
@@ -0,0 +1,106 @@
+#include "table.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static size_t mpeg_table_size(uint64_t cnt)
+{
+    return sizeof(mpeg_table_hdr_t) + size_t(cnt) * sizeof(mpeg_table_entry_t);
+}
+
+mpeg_table_t::~mpeg_table_t()
+{
+    close();
+}
+
+int mpeg_table_t::open(const char *name)
+{
+    char tmp[256];
+
+    // shm_open() names start with a slash
+    if (snprintf(tmp, sizeof(tmp), "%s%s", name[0] == '/' ? "" : "/", name) >= int(sizeof(tmp)))
+        return 1;
+
+    _fd = shm_open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (_fd < 0)
+        return 1;
+
+    _max = MPEG_TABLE_INITIAL;
+
+    if (ftruncate(_fd, off_t(mpeg_table_size(_max))))
+        return 1;
+
+    void *p = mmap(NULL, mpeg_table_size(_max), PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+
+    if (p == MAP_FAILED)
+        return 1;
+
+    _hdr = (mpeg_table_hdr_t *)p;
+    _hdr->version = MPEG_TABLE_VERSION;
+    _hdr->entry_size = sizeof(mpeg_table_entry_t);
+    _hdr->capacity.store(_max);
+    _hdr->count.store(0);
+    _hdr->done.store(0);
+
+    // readers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(_hdr->magic, MPEG_TABLE_MAGIC, sizeof(_hdr->magic));
+    return 0;
+}
+
+// the segment only grows, so old mappings stay valid for what they cover
+int mpeg_table_t::_grow()
+{
+    uint64_t max = 2 * _max;
+
+    if (ftruncate(_fd, off_t(mpeg_table_size(max))))
+        return 1;
+
+    void *p = mremap(_hdr, mpeg_table_size(_max), mpeg_table_size(max), MREMAP_MAYMOVE);
+
+    if (p == MAP_FAILED)
+        return 1;
+
+    _hdr = (mpeg_table_hdr_t *)p;
+    _max = max;
+    _hdr->capacity.store(max, std::memory_order_release);
+    return 0;
+}
+
+int mpeg_table_t::add(const mpeg_table_entry_t *ent)
+{
+    if (_hdr == NULL)
+        return 1;
+
+    if (_cnt >= _max && _grow())
+        return 1;
+
+    mpeg_table_entry_t *tab = (mpeg_table_entry_t *)(_hdr + 1);
+    tab[_cnt] = *ent;
+    _cnt += 1;
+
+    // publish the entry
+    _hdr->count.store(_cnt, std::memory_order_release);
+    return 0;
+}
+
+// the segment stays for the readers, it is removed with shm_unlink()
+void mpeg_table_t::close()
+{
+    if (_hdr != NULL)
+    {
+        _hdr->done.store(1, std::memory_order_release);
+        munmap(_hdr, mpeg_table_size(_max));
+        _hdr = NULL;
+    }
+
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+
@@ -0,0 +1,68 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <inttypes.h>
+#include <cstdio>
+#include <atomic>
+
+static constexpr char MPEG_TABLE_MAGIC[8] = { 'M', 'P', 'G', 'T', 'A', 'B', 'L', 0 };
+static constexpr uint32_t MPEG_TABLE_VERSION = 1;
+static constexpr uint64_t MPEG_TABLE_INITIAL = 65536;
+static constexpr uint8_t MPEG_TABLE_PACK = 0x01;
+static constexpr uint8_t MPEG_TABLE_PTS = 0x02;
+static constexpr uint8_t MPEG_TABLE_DTS = 0x04;
+
+// one pack or packet, packets carry the SCR of their pack
+struct mpeg_table_entry_t
+{
+    uint64_t ofs;
+    uint64_t scr;
+    uint64_t pts;
+    uint64_t dts;
+    uint32_t size;
+    uint8_t sid;
+    uint8_t ssid;
+    uint8_t flags;
+    uint8_t type;
+};
+
+struct mpeg_table_hdr_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    std::atomic<uint64_t> capacity;
+    std::atomic<uint64_t> count;
+    std::atomic<uint32_t> done;
+    uint32_t reserved1;
+    uint64_t reserved2[3];
+};
+
+static_assert(sizeof(mpeg_table_entry_t) == 40, "table entry layout");
+static_assert(sizeof(mpeg_table_hdr_t) == 64, "table header layout");
+
+/*
+ * Packet table in a POSIX shared memory segment, a 64 byte header
+ * followed by the entries in input order. Entries are only appended;
+ * an entry is complete once count covers it, and done is set when the
+ * parse has finished. Readers map the segment read-only and map it
+ * again when count grows beyond the capacity they mapped.
+ */
+class mpeg_table_t
+{
+private:
+    int _fd = -1;
+    mpeg_table_hdr_t *_hdr = nullptr;
+    uint64_t _cnt = 0;
+    uint64_t _max = 0;
+    int _grow();
+public:
+    ~mpeg_table_t();
+    int open(const char *name);
+    int add(const mpeg_table_entry_t *ent);
+    void close();
+};
+
+#endif
+
+